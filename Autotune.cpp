@@ -0,0 +1,479 @@
+/////////////////////////////////////////////////////////////////////////////
+// Filename: Autotune.cpp
+// Author:   Sameh Khamis
+//
+// Description: Offline search for the block and region parameters that
+//              solve a representative graph the fastest (make autotune)
+/////////////////////////////////////////////////////////////////////////////
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+using namespace std;
+
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <signal.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include "RegionPushRelabel.h"
+#include "DimacsReader.h"
+
+// The graphs to tune for, edit these to match your solver
+typedef Array<
+	Arc<0, 0, Offsets<1, 0> >, Arc<0, 0, Offsets<-1, 0> >, Arc<0, 0, Offsets<0, 1> >, Arc<0, 0, Offsets<0, -1> >
+> TuneOffsets;
+typedef int TuneCapType;
+typedef long TuneFlowType;
+#define TUNE_THREAD_COUNT 1
+
+// A candidate is stopped once its solve takes this many times longer than the fastest solve so far
+static const double EARLY_STOP_FACTOR = 2.0;
+
+static const size_t TUNE_DIMS = mpl::size<mpl::at_c<TuneOffsets, 0>::type::Offset>::value;
+
+/////////////////////////////////////////////////////////////////////////////
+// The graph is read once and replayed into every candidate
+
+static const char GRAPH_MAGIC[] = "RPRG";
+
+class RecordedGraph : public MaxflowSolver<size_t, TuneCapType, TuneFlowType>
+{
+private:
+	struct Terminal
+	{
+		size_t node;
+		TuneFlowType src_cap, snk_cap;
+	};
+
+	struct Edge
+	{
+		size_t node_i, node_j;
+		TuneCapType cap, rev_cap;
+	};
+
+	size_t node_count;
+	TuneCapType constant;
+	vector<Terminal> terminals;
+	vector<Edge> edges;
+
+	template <typename Type>
+	static bool read_vector(istream& in, vector<Type>& v)
+	{
+		size_t count;
+		if (!in.read((char*)&count, sizeof(count)))
+			return false;
+		v.resize(count);
+		return count == 0 || in.read((char*)&v[0], count * sizeof(Type));
+	}
+
+	template <typename Type>
+	static void write_vector(ostream& out, const vector<Type>& v)
+	{
+		size_t count = v.size();
+		out.write((const char*)&count, sizeof(count));
+		if (count > 0)
+			out.write((const char*)&v[0], count * sizeof(Type));
+	}
+
+public:
+	RecordedGraph(long[]) : node_count(0), constant(0)
+	{
+	}
+
+	void add_node(size_t nnodes) { node_count = nnodes; }
+	void add_constant_to_flow(TuneCapType amount) { constant += amount; }
+
+	void add_edge(size_t node_i, size_t node_j, TuneCapType cap, TuneCapType rev_cap)
+	{
+		Edge edge = { node_i, node_j, cap, rev_cap };
+		edges.push_back(edge);
+	}
+
+	void add_terminal_weights(size_t node_id, TuneFlowType src_cap, TuneFlowType snk_cap)
+	{
+		Terminal terminal = { node_id, src_cap, snk_cap };
+		terminals.push_back(terminal);
+	}
+
+	void compute_maxflow() {}
+	TuneFlowType get_flow() { return 0; }
+	int get_segment(size_t) { return 0; }
+
+	void swap(RecordedGraph& other)
+	{
+		std::swap(node_count, other.node_count);
+		std::swap(constant, other.constant);
+		terminals.swap(other.terminals);
+		edges.swap(other.edges);
+	}
+
+	template <typename Solver>
+	void replay(Solver& g) const
+	{
+		g.add_node(node_count);
+		for (size_t i = 0; i < terminals.size(); i++)
+			g.add_terminal_weights(terminals[i].node, terminals[i].src_cap, terminals[i].snk_cap);
+		for (size_t i = 0; i < edges.size(); i++)
+			g.add_edge(edges[i].node_i, edges[i].node_j, edges[i].cap, edges[i].rev_cap);
+		g.add_constant_to_flow(constant);
+	}
+
+	// The binary format is the raw records, so it only reads back on the machine and build that wrote it
+	static bool is_binary(const string& filename)
+	{
+		char magic[4];
+		ifstream in(filename.c_str(), ios::binary);
+		return in.read(magic, 4) && memcmp(magic, GRAPH_MAGIC, 4) == 0;
+	}
+
+	bool load(const string& filename)
+	{
+		char magic[4];
+		ifstream in(filename.c_str(), ios::binary);
+		return in.read(magic, 4) && memcmp(magic, GRAPH_MAGIC, 4) == 0 &&
+			in.read((char*)&node_count, sizeof(node_count)) && in.read((char*)&constant, sizeof(constant)) &&
+			read_vector(in, terminals) && read_vector(in, edges);
+	}
+
+	bool save(const string& filename)
+	{
+		ofstream out(filename.c_str(), ios::binary);
+		out.write(GRAPH_MAGIC, 4);
+		out.write((const char*)&node_count, sizeof(node_count));
+		out.write((const char*)&constant, sizeof(constant));
+		write_vector(out, terminals);
+		write_vector(out, edges);
+		return out.good();
+	}
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// The precompiled candidates
+
+template <size_t Dims, long Side2D, long Side3D> struct SquareBlocks;
+template <long Side2D, long Side3D> struct SquareBlocks<2, Side2D, Side3D> { typedef BlockDimensions<Side2D, Side2D> type; };
+template <long Side2D, long Side3D> struct SquareBlocks<3, Side2D, Side3D> { typedef BlockDimensions<Side3D, Side3D, Side3D> type; };
+
+// Blocks are square with the side for the dimension count of TuneOffsets, the blocks per region are in
+// halves of the default (the node neighborhood) and the discharges per block are in quarters of the nodes
+// in a region (the default is 2 quarters)
+template <long Side2D, long Side3D, size_t RegionHalves, size_t DischargeQuarters,
+	size_t Density, unsigned PageBlocks, size_t UpdateFrequency>
+struct Candidate
+{
+	typedef Layout<TuneOffsets, typename SquareBlocks<TUNE_DIMS, Side2D, Side3D>::type> TuneLayout;
+	static const size_t REGION_BLOCKS = RegionHalves * (mpl::size<TuneOffsets>::value + 1) / 2;
+	static const size_t DISCHARGES = DischargeQuarters * TuneLayout::NODES_PER_BLOCK * REGION_BLOCKS / 4;
+
+	typedef RegionPushRelabel<
+		TuneCapType, TuneFlowType,
+		TuneLayout,
+		ThreadCount<TUNE_THREAD_COUNT>,
+		MaxBlocksPerRegion<REGION_BLOCKS>,
+		DischargesPerBlock<DISCHARGES>,
+		BucketDensity<Density>,
+		BlocksPerMemoryPage<PageBlocks>,
+		GlobalUpdateFrequency<UpdateFrequency>
+	> Solver;
+
+	static string describe()
+	{
+		long side = TUNE_DIMS == 2 ? Side2D : Side3D;
+		stringstream out;
+		out << "BlockDimensions<" << side << ", " << side;
+		if (TUNE_DIMS == 3)
+			out << ", " << side;
+		out << ">, MaxBlocksPerRegion<" << REGION_BLOCKS << ">, DischargesPerBlock<" << DISCHARGES
+			<< ">, BucketDensity<" << Density << ">, BlocksPerMemoryPage<" << PageBlocks
+			<< ">, GlobalUpdateFrequency<" << UpdateFrequency << ">";
+		return out.str();
+	}
+
+	// Runs in a child process, which the timer kills with SIGALRM once the solve takes longer than time_limit
+	static void solve(const RecordedGraph& graph, long dimensions[], double time_limit, double& seconds, TuneFlowType& flow)
+	{
+		using namespace boost::posix_time;
+
+		Solver* g = new Solver(dimensions);
+		graph.replay(*g);
+
+		if (time_limit > 0)
+		{
+			itimerval timer;
+			memset(&timer, 0, sizeof(timer));
+			timer.it_value.tv_sec = (long)time_limit;
+			timer.it_value.tv_usec = (long)((time_limit - (long)time_limit) * 1e6) + 1;
+			setitimer(ITIMER_REAL, &timer, NULL);
+		}
+
+		ptime start = microsec_clock::universal_time();
+		g->compute_maxflow();
+		seconds = (microsec_clock::universal_time() - start).total_microseconds() / 1e6;
+		flow = g->get_flow();
+		delete g;
+	}
+};
+
+typedef string (*DescribeFunction)();
+typedef void (*SolveFunction)(const RecordedGraph&, long[], double, double&, TuneFlowType&);
+
+#define CANDIDATE(...) { &Candidate<__VA_ARGS__>::describe, &Candidate<__VA_ARGS__>::solve }
+
+// The first candidate is the baseline: the blocks of the precompiled library and the default parameters,
+// the others change one or two parameters from it
+static const struct { DescribeFunction describe; SolveFunction solve; } candidates[] =
+{
+	CANDIDATE(16, 4, 2, 2, 1, 50, 200),
+	CANDIDATE(32, 6, 2, 2, 1, 50, 200),
+	CANDIDATE(64, 8, 2, 2, 1, 50, 200),
+	CANDIDATE(16, 4, 1, 2, 1, 50, 200),
+	CANDIDATE(16, 4, 4, 2, 1, 50, 200),
+	CANDIDATE(16, 4, 2, 1, 1, 50, 200),
+	CANDIDATE(16, 4, 2, 4, 1, 50, 200),
+	CANDIDATE(16, 4, 2, 8, 1, 50, 200),
+	CANDIDATE(16, 4, 2, 2, 4, 50, 200),
+	CANDIDATE(16, 4, 2, 2, 1, 10, 200),
+	CANDIDATE(16, 4, 2, 2, 1, 200, 200),
+	CANDIDATE(16, 4, 2, 2, 1, 50, 50),
+	CANDIDATE(16, 4, 2, 2, 1, 50, 1000),
+	CANDIDATE(32, 6, 4, 2, 1, 50, 200),
+	CANDIDATE(32, 6, 2, 4, 1, 50, 200)
+};
+static const size_t CANDIDATE_COUNT = sizeof(candidates) / sizeof(candidates[0]);
+
+/////////////////////////////////////////////////////////////////////////////
+// The search
+
+struct Trial
+{
+	double seconds;
+	TuneFlowType flow;
+	long memory; // KB
+};
+
+struct Standing
+{
+	size_t candidate;
+	double seconds; // best so far
+	long memory; // KB, largest so far
+
+	bool operator<(const Standing& other) const { return seconds < other.seconds; }
+};
+
+// Solves the graph in a child process, so that a slow candidate can be stopped and the memory it used measured,
+// returns false if the candidate was stopped or failed
+static bool run_trial(size_t candidate, const RecordedGraph& graph, long dimensions[], double time_limit, Trial& trial)
+{
+	int fds[2];
+	if (pipe(fds) != 0)
+	{
+		cout << "Could not create a pipe. Try again." << endl;
+		exit(1);
+	}
+
+	cout.flush();
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		::close(fds[0]);
+
+		// The peak resident set starts at the size inherited from the parent
+		rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		long start_memory = usage.ru_maxrss;
+
+		Trial result;
+		candidates[candidate].solve(graph, dimensions, time_limit, result.seconds, result.flow);
+
+		getrusage(RUSAGE_SELF, &usage);
+		result.memory = usage.ru_maxrss - start_memory;
+		ssize_t written = ::write(fds[1], &result, sizeof(result));
+		_exit(written == sizeof(result) ? 0 : 1);
+	}
+	::close(fds[1]);
+	if (pid < 0)
+	{
+		::close(fds[0]);
+		cout << "Could not start a trial. Try again." << endl;
+		exit(1);
+	}
+
+	bool finished = ::read(fds[0], &trial, sizeof(trial)) == sizeof(trial);
+	::close(fds[0]);
+
+	int status;
+	waitpid(pid, &status, 0);
+	return finished && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Successive halving: every round solves the graph once with each remaining candidate, and the faster half
+// goes on to the next round, until one candidate is left besides the baseline, which runs every round
+static size_t search(const RecordedGraph& graph, long dimensions[], long memory_budget, double& baseline_seconds, double& best_seconds)
+{
+	vector<Standing> standings;
+	for (size_t c = 0; c < CANDIDATE_COUNT; c++)
+	{
+		Standing standing = { c, 0, 0 };
+		standings.push_back(standing);
+	}
+
+	TuneFlowType expected_flow = 0;
+	best_seconds = 0;
+	for (size_t round = 1; standings.size() > 1; round++)
+	{
+		cout << "Round " << round << ", " << standings.size() << " candidates" << endl;
+
+		vector<Standing> finished;
+		for (size_t s = 0; s < standings.size(); s++)
+		{
+			Standing& standing = standings[s];
+			size_t c = standing.candidate;
+			cout << "  " << candidates[c].describe() << ": " << flush;
+
+			// The baseline always runs to the end, it sets the expected flow and the first time limit
+			double time_limit = c == 0 ? 0 : best_seconds * EARLY_STOP_FACTOR;
+			Trial trial;
+			if (!run_trial(c, graph, dimensions, time_limit, trial))
+			{
+				if (c == 0)
+				{
+					cout << "failed" << endl << "The baseline did not solve the graph. Try other dimensions." << endl;
+					exit(1);
+				}
+				cout << "stopped" << endl;
+				continue;
+			}
+
+			if (c == 0)
+				expected_flow = trial.flow;
+			else if (trial.flow != expected_flow)
+			{
+				cout << "wrong flow " << trial.flow << " (expected " << expected_flow << ")" << endl;
+				continue;
+			}
+
+			if (standing.seconds == 0 || trial.seconds < standing.seconds)
+				standing.seconds = trial.seconds;
+			standing.memory = max(standing.memory, trial.memory);
+			cout << fixed << setprecision(3) << trial.seconds << "s, " << trial.memory / 1024 << " MB";
+
+			if (memory_budget > 0 && standing.memory > memory_budget * 1024)
+			{
+				cout << ", over the memory budget" << endl;
+				if (c != 0)
+					continue;
+			}
+			else
+				cout << endl;
+
+			if (best_seconds == 0 || standing.seconds < best_seconds)
+				best_seconds = standing.seconds;
+			finished.push_back(standing);
+		}
+
+		// Keep the baseline in front and the faster half of the others after it
+		baseline_seconds = finished[0].seconds;
+		sort(finished.begin() + 1, finished.end());
+		if (finished.size() <= 2)
+		{
+			standings = finished;
+			break;
+		}
+		finished.resize(1 + finished.size() / 2);
+		standings = finished;
+	}
+
+	// The baseline wins if nothing else finished, or if it stayed within the budget and was faster
+	bool baseline_fits = memory_budget == 0 || standings[0].memory <= memory_budget * 1024;
+	if (standings.size() == 1 || (baseline_fits && standings[0].seconds <= standings[1].seconds))
+	{
+		best_seconds = baseline_seconds;
+		return 0;
+	}
+	best_seconds = standings[1].seconds;
+	return standings[1].candidate;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2 + (int)TUNE_DIMS)
+	{
+		cout << "Usage: " << argv[0] << " <graph> <dimension 1> ... <dimension " << TUNE_DIMS << ">"
+			<< " [-m <memory budget in MB>] [-s <binary graph to write>]" << endl;
+		cout << "The graph is a DIMACS file, or a binary file written with -s, and the layout is TuneOffsets in Autotune.cpp" << endl;
+		return 1;
+	}
+
+	string filename = argv[1];
+	long dimensions[TUNE_DIMS];
+	for (size_t d = 0; d < TUNE_DIMS; d++)
+		dimensions[d] = atol(argv[2 + d]);
+
+	long memory_budget = 0;
+	string save_filename;
+	for (int i = 2 + TUNE_DIMS; i + 1 < argc; i += 2)
+	{
+		if (strcmp(argv[i], "-m") == 0)
+			memory_budget = atol(argv[i + 1]);
+		else if (strcmp(argv[i], "-s") == 0)
+			save_filename = argv[i + 1];
+	}
+
+	RecordedGraph graph(dimensions);
+	if (RecordedGraph::is_binary(filename))
+	{
+		if (!graph.load(filename))
+		{
+			cout << "Could not read the binary graph " << filename << ". Try writing it again with -s." << endl;
+			return 1;
+		}
+	}
+	else
+	{
+		DimacsReader<RecordedGraph> reader(filename, dimensions);
+		if (!reader.parse())
+		{
+			cout << "Could not read the DIMACS graph " << filename << ". Try checking the path and format." << endl;
+			return 1;
+		}
+		graph.swap(*reader.get_solver());
+	}
+
+	if (!save_filename.empty() && !graph.save(save_filename))
+	{
+		cout << "Could not write " << save_filename << ". Try another path." << endl;
+		return 1;
+	}
+
+	// The trials swap their memory pages to files in a scratch directory, which also catches the files
+	// of the trials that were stopped
+	char scratch[] = "autotuneXXXXXX";
+	if (mkdtemp(scratch) == NULL || chdir(scratch) != 0)
+	{
+		cout << "Could not create a scratch directory. Try another working directory." << endl;
+		return 1;
+	}
+
+	double baseline_seconds = 0, best_seconds = 0;
+	size_t best = search(graph, dimensions, memory_budget, baseline_seconds, best_seconds);
+
+	if (chdir("..") == 0)
+		boost::filesystem::remove_all(scratch);
+
+	cout << endl << "Best configuration: " << candidates[best].describe() << endl;
+	if (best == 0)
+		cout << "No candidate was faster than the baseline" << endl;
+	else
+		cout << "Speedup over the baseline: " << fixed << setprecision(2) << baseline_seconds / best_seconds << "x" << endl;
+	return 0;
+}
@@ -24,6 +24,7 @@
 #include <boost/mpl/transform.hpp>
 #include <boost/mpl/max_element.hpp>
 #include <boost/mpl/greater.hpp>
+#include <boost/mpl/if.hpp>
 #include <boost/mpl/unique.hpp>
 #include <boost/mpl/equal.hpp>
 #include <boost/mpl/placeholders.hpp>
@@ -160,6 +161,16 @@ class BlocksPerMemoryPageTag {};
 template <size_t X> class BlocksPerMemoryPage : public mp::int_<X>, public BlocksPerMemoryPageTag {};
 class GlobalUpdateFrequencyTag {};
 template <size_t X> class GlobalUpdateFrequency : public mp::int_<X>, public GlobalUpdateFrequencyTag {};
+class BlockSchedulingTag {};
+template <size_t X> class BlockScheduling : public mp::int_<X>, public BlockSchedulingTag {};
+class RegionSolverTag {};
+template <size_t X> class RegionSolver : public mp::int_<X>, public RegionSolverTag {};
+
+// Block scheduling policies
+enum { FifoScheduling, HighestLabelScheduling, LargestExcessScheduling };
+
+// Region solvers
+enum { PushRelabelSolver, AugmentingPathSolver };
 
 class OffsetsTag {};
 
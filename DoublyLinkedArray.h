@@ -3,93 +3,161 @@
 // Author:   Sameh Khamis
 //
 // Description: Algorithm-specific data structure - a doubly linked list
-//              embedded in an array
+//              embedded in an array, optionally split into priority buckets
 /////////////////////////////////////////////////////////////////////////////
 #ifndef _DOUBLY_LINKED_ARRAY
 #define _DOUBLY_LINKED_ARRAY
 
+#include <boost/cstdint.hpp>
+
 template <typename Type>
 class DoublyLinkedArray
 {
 private:
 	typedef pair<Type, Type> Node;
-	Type first, last;
+	typedef boost::uint64_t BucketMask;
+
+	// Priorities are coarsened down to this many buckets, so that the non-empty ones fit in a word
+	static const Type MAX_BUCKETS = 64;
+
+	Type *first, *last;
 	Node *nodes;
+	Type *buckets;
 	Type size, count;
+	Type bucket_count, bucket_shift;
+	BucketMask occupied; // bit b is set while bucket b holds elements
+
+	static Type highest_bit(BucketMask bits)
+	{
+		// Binary search for the highest set bit, bits must not be zero
+		Type bit = 0;
+		for (Type half = 32; half > 0; half /= 2)
+			if ((bits >> half) != 0)
+			{
+				bits >>= half;
+				bit += half;
+			}
+		return bit;
+	}
+
+	Type find_bucket(Type bucket)
+	{
+		// Find the highest non-empty bucket at or below the given one, the shift wraps to all ones for the top bucket
+		BucketMask below = occupied & (((BucketMask)2 << bucket) - 1);
+		return (below != 0) ? highest_bit(below) : 0;
+	}
 
 public:
-	DoublyLinkedArray(Type size)
+	DoublyLinkedArray(Type size, Type bucket_count = 1)
 	{
 		this->size = size;
+		bucket_shift = 0;
+		while (((bucket_count - 1) >> bucket_shift) >= MAX_BUCKETS)
+			bucket_shift++;
+		this->bucket_count = ((bucket_count - 1) >> bucket_shift) + 1;
 		nodes = new Node[size];
-		for (unsigned i = 0; i < size; i++)
+		buckets = new Type[size];
+		for (Type i = 0; i < size; i++)
 		{
 			nodes[i].first = size;
 			nodes[i].second = size;
+			buckets[i] = 0;
 		}
-		first = last = size;
+		first = new Type[this->bucket_count];
+		last = new Type[this->bucket_count];
+		for (Type b = 0; b < this->bucket_count; b++)
+			first[b] = last[b] = size;
+		occupied = 0;
 		count = 0;
 	}
 
 	~DoublyLinkedArray()
 	{
 		delete[] nodes;
+		delete[] buckets;
+		delete[] first;
+		delete[] last;
 	}
 
-	unsigned get_count()
+	Type get_count()
 	{
 		return count;
 	}
 
 	bool empty()
 	{
-		return first == size;
+		return count == 0;
+	}
+
+	bool contains(const Type& id)
+	{
+		return id == first[buckets[id]] || nodes[id].first != size;
+	}
+
+	// Iteration from the highest bucket down, end() is returned past the last element
+	Type end()
+	{
+		return size;
+	}
+
+	Type front()
+	{
+		return first[find_bucket(bucket_count - 1)];
 	}
 
-	void push_back(const Type& id)
+	Type next(const Type& id)
 	{
-		if (!empty())
+		if (nodes[id].second != size || buckets[id] == 0)
+			return nodes[id].second;
+		return first[find_bucket(buckets[id] - 1)];
+	}
+
+	void push_back(const Type& id, Type bucket = 0)
+	{
+		bucket >>= bucket_shift;
+		if (bucket >= bucket_count)
+			bucket = bucket_count - 1;
+		buckets[id] = bucket;
+		occupied |= (BucketMask)1 << bucket;
+
+		if (first[bucket] != size)
 		{
-			nodes[last].second = id;
-			nodes[id].first = last;
+			nodes[last[bucket]].second = id;
+			nodes[id].first = last[bucket];
 		}
 		else
-			first = id;
-		last = id;
+			first[bucket] = id;
+		last[bucket] = id;
 		count++;
 	}
 
 	Type pop_front()
 	{
-		Type old_first = first;
-		first = nodes[first].second;
-		nodes[old_first].second = size;
-
-		if (!empty())
-			nodes[first].first = size;
-		else
-			last = size;
-
-		count--;
+		Type old_first = front();
+		remove(old_first);
 		return old_first;
 	}
 
 	void remove(Type id)
 	{
-		if (id == first)
-			pop_front();
-		else
-		{
-			if (id == last)
-				last = nodes[id].first;
-			else
-				nodes[nodes[id].second].first = nodes[id].first;
+		Type bucket = buckets[id];
 
+		if (id == first[bucket])
+			first[bucket] = nodes[id].second;
+		else
 			nodes[nodes[id].first].second = nodes[id].second;
-			nodes[id].first = size;
-			nodes[id].second = size;
-			count--;
-		}
+
+		if (id == last[bucket])
+			last[bucket] = nodes[id].first;
+		else
+			nodes[nodes[id].second].first = nodes[id].first;
+
+		if (first[bucket] == size)
+			occupied &= ~((BucketMask)1 << bucket);
+
+		nodes[id].first = size;
+		nodes[id].second = size;
+		count--;
 	}
 };
 
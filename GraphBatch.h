@@ -0,0 +1,44 @@
+/////////////////////////////////////////////////////////////////////////////
+// Filename: GraphBatch.h
+// Author:   Sameh Khamis
+//
+// Description: Batch solver for many small independent graphs of the same
+//              dimensions, one whole graph per worker at a time
+/////////////////////////////////////////////////////////////////////////////
+#ifndef _GRAPH_BATCH
+#define _GRAPH_BATCH
+
+#include <boost/thread.hpp>
+using namespace boost;
+
+#include <vector>
+using namespace std;
+
+// The workers are started once per batch and pull the graphs one by one, each graph is solved by a
+// single-threaded Solver (ThreadCount<1>) that only lives for that graph
+template <typename Solver>
+class GraphBatch
+{
+private:
+	vector<long> dims;
+	int thread_count;
+
+	mutex batch_mutex;
+	size_t next_graph;
+	size_t graph_count;
+
+	template <typename Builder, typename Collector>
+	void work_loop(Builder* builder, Collector* collector);
+
+public:
+	GraphBatch(long dimensions[], size_t dimension_count, int thread_count);
+
+	// builder(graph, solver) adds the edges and terminal weights of a graph, and collector(graph, solver)
+	// reads its flow and segments, both are called from the workers for different graphs at the same time
+	template <typename Builder, typename Collector>
+	void solve(size_t graph_count, Builder builder, Collector collector);
+};
+
+#include "GraphBatch.tpl"
+
+#endif
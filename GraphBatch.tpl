@@ -0,0 +1,63 @@
+/////////////////////////////////////////////////////////////////////////////
+// Filename: GraphBatch.tpl
+// Author:   Sameh Khamis
+//
+// Description: Batch solver for many small independent graphs of the same
+//              dimensions, one whole graph per worker at a time
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "GraphBatch.h"
+
+template <typename Solver>
+GraphBatch<Solver>::GraphBatch(long dimensions[], size_t dimension_count, int thread_count)
+{
+	dims.assign(dimensions, dimensions + dimension_count);
+	this->thread_count = thread_count;
+	next_graph = 0;
+	graph_count = 0;
+}
+
+template <typename Solver>
+template <typename Builder, typename Collector>
+void GraphBatch<Solver>::solve(size_t graph_count, Builder builder, Collector collector)
+{
+	this->graph_count = graph_count;
+	next_graph = 0;
+
+	// Creates (thread_count - 1) threads and joins in on the action
+	thread_group tgrp;
+	for (int i = 1; i < thread_count; i++)
+		tgrp.add_thread(new thread(&GraphBatch::work_loop<Builder, Collector>, this, &builder, &collector));
+
+	work_loop(&builder, &collector);
+	tgrp.join_all();
+}
+
+template <typename Solver>
+template <typename Builder, typename Collector>
+void GraphBatch<Solver>::work_loop(Builder* builder, Collector* collector)
+{
+	Solver* solver;
+	size_t graph;
+
+	while (true)
+	{
+		{
+			mutex::scoped_lock lock(batch_mutex);
+			if (next_graph == graph_count)
+				return;
+			graph = next_graph++;
+
+			// Solvers are created one at a time, they set up the shared layout tables on first use
+			// and pick their temporary file names at random
+			solver = new Solver(&dims[0]);
+		}
+
+		(*builder)(graph, *solver);
+		solver->compute_maxflow();
+		(*collector)(graph, *solver);
+
+		delete solver;
+	}
+}
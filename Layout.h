@@ -21,6 +21,8 @@
 #include <vector>
 using namespace std;
 
+#include <boost/thread/mutex.hpp>
+
 #include "CompileTimeUtils.h"
 
 // Use Array to initialize an array of arcs, which just wraps mp::vector
@@ -43,9 +45,28 @@ public:
 	static const size_t NODE_EDGE_COUNT = mp::max_element<FromCountVector>::type::type::value;
 	static const size_t NODES_PER_CELL = mp::size<FromCountVector>::value;
 	static const size_t NODES_PER_BLOCK = NODES_PER_CELL * product<BlockDimensions>::value;
+	static const size_t CACHE_LINE_SIZE = 64;
+
+	// Node shifts never leave the block, so they fit in 16 bits for all but the largest blocks
+	typedef typename mp::if_c<(NODES_PER_BLOCK < 32768), short, ptrdiff_t>::type ShiftType;
+	typedef unsigned char BlockEdgeType;
+
+	// Node indices within a block, kept to 16 bits for all but the largest blocks
+	typedef typename mp::if_c<(NODES_PER_BLOCK <= 65536), unsigned short, unsigned>::type NodeIndexType;
+	typedef signed char SisterType;
+
+	// Everything a node needs to reach its neighbors, one entry per cell index and location index
+	struct NodeLookup
+	{
+		ShiftType shift[NODE_EDGE_COUNT];
+		BlockEdgeType block_edge[NODE_EDGE_COUNT];
+		SisterType sister[NODE_EDGE_COUNT];
+	};
 
 	// Static variables
 	static ptrdiff_t block_dimensions[DIM_COUNT];
+	static size_t block_edge_count;
+	static size_t location_counts[NODES_PER_CELL];
 
 	static void init();
 
@@ -59,15 +80,15 @@ public:
 
 	// Instance variables and functions
 	size_t node_count;
-	size_t block_edge_count;
+	size_t original_node_count;
 	size_t block_count;
-	size_t location_counts[NODES_PER_CELL];
 
 	Layout(long dimensions[]);
 
-	ptrdiff_t* get_sister_edges(unsigned char cell_index);
+	const NodeLookup& get_node_lookup(unsigned char cell_index, unsigned short location_index);
+	SisterType* get_sister_edges(unsigned char cell_index);
 	void get_node_block_index(size_t node_id, size_t& block_id, size_t& node_subid);
-	ptrdiff_t* get_block_edge(unsigned char cell_index, unsigned short location_index);
+	BlockEdgeType* get_block_edge(unsigned char cell_index, unsigned short location_index);
 	ptrdiff_t* get_node_edge_mask(unsigned char cell_index, unsigned short location_index);
 	ptrdiff_t get_edge_count(unsigned char cell_index);
 
@@ -75,71 +96,87 @@ public:
 	unsigned short get_node_location_index(Coord& coord);
 	unsigned short get_block_location_index(Coord& coord);
 
-	ptrdiff_t* get_node_shift_vector(unsigned char cell_index, unsigned short location_index);
+	ShiftType* get_node_shift_vector(unsigned char cell_index, unsigned short location_index);
 	ptrdiff_t* get_block_shift_vector(unsigned short location_index);
 
 	void get_node_coord(size_t block_id, size_t node_subid, Coord& coord);
 	void get_block_coord(size_t block_id, Coord& coord);
 	size_t get_node_id(size_t node_id);
+	size_t get_complete_block_count(size_t node_id);
 
 private:
 	// Static variables
 	static bool initialized;
-	static ptrdiff_t edge_sister[NODES_PER_CELL][NODE_EDGE_COUNT];
+	static boost::mutex init_mutex;
 	static vector<ptrdiff_t> offsets[NODES_PER_CELL][DIM_COUNT];
 	static ptrdiff_t edge_count_by_cell_index[NODES_PER_CELL];
 
+	// Node look-up table, flat and aligned to a cache line
+	static NodeLookup* node_lookup;
+	static size_t node_lookup_start[NODES_PER_CELL];
+
 	// Block correspondance
-	vector<vector<ptrdiff_t> > block_edge[NODES_PER_CELL];
-	vector<vector<ptrdiff_t> > node_edge_mask[NODES_PER_CELL];
+	static vector<ptrdiff_t> block_offsets[DIM_COUNT];
+	static vector<vector<ptrdiff_t> > node_edge_mask[NODES_PER_CELL];
 
 	// Node shift calculation
+	static size_t block_dimension_strides[DIM_COUNT];
+	static size_t offset_strides[NODES_PER_CELL][DIM_COUNT];
+	static vector<size_t> ranges[NODES_PER_CELL][DIM_COUNT];
+
 	bool sizes_changed;
 	ptrdiff_t original_sizes[DIM_COUNT];
 	ptrdiff_t sizes[DIM_COUNT];
-	size_t block_dimension_strides[DIM_COUNT];
 	size_t original_size_strides[DIM_COUNT];
 	size_t size_strides[DIM_COUNT];
-	size_t offset_strides[NODES_PER_CELL][DIM_COUNT];
-	vector<size_t> ranges[NODES_PER_CELL][DIM_COUNT];
-	vector<vector<ptrdiff_t> > shifts[NODES_PER_CELL];
 
-	// Block shift calculation
+	// Block shift calculation, flat with block_edge_count entries per location index
 	size_t block_offset_strides[DIM_COUNT];
 	size_t block_strides[DIM_COUNT];
 	vector<size_t> block_ranges[DIM_COUNT];
-	vector<vector<ptrdiff_t> > block_shifts;
+	vector<ptrdiff_t> block_shifts;
 
 	// Offset index calculation
-	size_t compute_offset_lut(ptrdiff_t shift_sizes[], size_t shift_strides[],
+	static size_t compute_offset_lut(ptrdiff_t shift_sizes[], size_t shift_strides[],
 		vector<ptrdiff_t> offsets[], size_t offset_strides[],
 		vector<size_t> ranges[], vector<vector<ptrdiff_t> >& shifts);
 
 	// Block edge calcuation
-	void compute_block_edges(
+	static void compute_block_edges(
 		ptrdiff_t shift_sizes[], vector<ptrdiff_t> offsets[], size_t offset_strides[],
 		vector<size_t> ranges[], size_t location_count,
 		vector<ptrdiff_t> block_offsets[], vector<vector<ptrdiff_t> >& block_edges);
 
-	void compute_node_edge_masks(
+	static void compute_node_edge_masks(
 		vector<vector<ptrdiff_t> > block_edge[], size_t location_counts[],
 		vector<vector<ptrdiff_t> > node_edge_mask[]);
 
-	void compute_strides(ptrdiff_t sizes[], size_t strides[]);
-	unsigned short get_location_index(Coord& coord, size_t offset_strides[], vector<size_t> ranges[]);
+	static void compute_node_lookup(
+		vector<vector<ptrdiff_t> > shifts[], vector<vector<ptrdiff_t> > block_edge[],
+		ptrdiff_t edge_sister[][NODE_EDGE_COUNT]);
+
+	static void compute_strides(ptrdiff_t sizes[], size_t strides[]);
+	static unsigned short get_location_index(Coord& coord, size_t offset_strides[], vector<size_t> ranges[]);
 };
 
 // Inline methods
 template <typename OffsetVector, typename BlockDimensions>
-INLINE ptrdiff_t* Layout<OffsetVector, BlockDimensions>::get_sister_edges(unsigned char cell_index)
+INLINE const typename Layout<OffsetVector, BlockDimensions>::NodeLookup& Layout<OffsetVector, BlockDimensions>::get_node_lookup(unsigned char cell_index, unsigned short location_index)
+{
+	return node_lookup[node_lookup_start[cell_index] + location_index];
+}
+
+template <typename OffsetVector, typename BlockDimensions>
+INLINE typename Layout<OffsetVector, BlockDimensions>::SisterType* Layout<OffsetVector, BlockDimensions>::get_sister_edges(unsigned char cell_index)
 {
-	return edge_sister[cell_index];
+	// Sister edges only depend on the cell index, any location index will do
+	return node_lookup[node_lookup_start[cell_index]].sister;
 }
 
 template <typename OffsetVector, typename BlockDimensions>
-INLINE ptrdiff_t* Layout<OffsetVector, BlockDimensions>::get_block_edge(unsigned char cell_index, unsigned short location_index)
+INLINE typename Layout<OffsetVector, BlockDimensions>::BlockEdgeType* Layout<OffsetVector, BlockDimensions>::get_block_edge(unsigned char cell_index, unsigned short location_index)
 {
-	return &block_edge[cell_index][location_index][0];
+	return node_lookup[node_lookup_start[cell_index] + location_index].block_edge;
 }
 
 template <typename OffsetVector, typename BlockDimensions>
@@ -157,27 +194,45 @@ INLINE ptrdiff_t Layout<OffsetVector, BlockDimensions>::get_edge_count(unsigned
 template <typename OffsetVector, typename BlockDimensions>
 INLINE ptrdiff_t* Layout<OffsetVector, BlockDimensions>::get_block_shift_vector(unsigned short location_index)
 {
-	return &block_shifts[location_index][0];
+	return &block_shifts[location_index * block_edge_count];
 }
 
 template <typename OffsetVector, typename BlockDimensions>
-INLINE ptrdiff_t* Layout<OffsetVector, BlockDimensions>::get_node_shift_vector(unsigned char cell_index, unsigned short location_index)
+INLINE typename Layout<OffsetVector, BlockDimensions>::ShiftType* Layout<OffsetVector, BlockDimensions>::get_node_shift_vector(unsigned char cell_index, unsigned short location_index)
 {
-	return &shifts[cell_index][location_index][0];
+	return node_lookup[node_lookup_start[cell_index] + location_index].shift;
 }
 
 // Static member instantiation
 template <typename OffsetVector, typename BlockDimensions>
-ptrdiff_t Layout<OffsetVector, BlockDimensions>::edge_sister[NODES_PER_CELL][NODE_EDGE_COUNT];
-template <typename OffsetVector, typename BlockDimensions>
 ptrdiff_t Layout<OffsetVector, BlockDimensions>::edge_count_by_cell_index[NODES_PER_CELL];
 template <typename OffsetVector, typename BlockDimensions>
 vector<ptrdiff_t> Layout<OffsetVector, BlockDimensions>::offsets[NODES_PER_CELL][DIM_COUNT];
 template <typename OffsetVector, typename BlockDimensions>
 ptrdiff_t Layout<OffsetVector, BlockDimensions>::block_dimensions[DIM_COUNT];
+template <typename OffsetVector, typename BlockDimensions>
+size_t Layout<OffsetVector, BlockDimensions>::block_edge_count;
+template <typename OffsetVector, typename BlockDimensions>
+size_t Layout<OffsetVector, BlockDimensions>::location_counts[NODES_PER_CELL];
+template <typename OffsetVector, typename BlockDimensions>
+typename Layout<OffsetVector, BlockDimensions>::NodeLookup* Layout<OffsetVector, BlockDimensions>::node_lookup;
+template <typename OffsetVector, typename BlockDimensions>
+size_t Layout<OffsetVector, BlockDimensions>::node_lookup_start[NODES_PER_CELL];
+template <typename OffsetVector, typename BlockDimensions>
+vector<ptrdiff_t> Layout<OffsetVector, BlockDimensions>::block_offsets[DIM_COUNT];
+template <typename OffsetVector, typename BlockDimensions>
+vector<vector<ptrdiff_t> > Layout<OffsetVector, BlockDimensions>::node_edge_mask[NODES_PER_CELL];
+template <typename OffsetVector, typename BlockDimensions>
+size_t Layout<OffsetVector, BlockDimensions>::block_dimension_strides[DIM_COUNT];
+template <typename OffsetVector, typename BlockDimensions>
+size_t Layout<OffsetVector, BlockDimensions>::offset_strides[NODES_PER_CELL][DIM_COUNT];
+template <typename OffsetVector, typename BlockDimensions>
+vector<size_t> Layout<OffsetVector, BlockDimensions>::ranges[NODES_PER_CELL][DIM_COUNT];
 
 template <typename OffsetVector, typename BlockDimensions>
 bool Layout<OffsetVector, BlockDimensions>::initialized = false;
+template <typename OffsetVector, typename BlockDimensions>
+boost::mutex Layout<OffsetVector, BlockDimensions>::init_mutex;
 
 #include "Layout.tpl"
 
@@ -13,7 +13,8 @@
 template <typename OffsetVector, typename BlockDimensions>
 void Layout<OffsetVector, BlockDimensions>::init()
 {
-	// Check if class is already initialized
+	// Check if class is already initialized, layouts can be created from several threads
+	boost::mutex::scoped_lock lock(init_mutex);
 	if (initialized)
 		return;
 
@@ -31,6 +32,7 @@ void Layout<OffsetVector, BlockDimensions>::init()
 	mpl::for_each<FromCountVector>(CollectIntegers(edge_count_by_cell_index));
 
 	// Discover sister edges
+	ptrdiff_t edge_sister[NODES_PER_CELL][NODE_EDGE_COUNT];
 	for (size_t c = 0; c < NODES_PER_CELL; c++)
 		for (size_t e = 0; e < NODE_EDGE_COUNT; e++)
 			edge_sister[c][e] = -1;
@@ -66,6 +68,31 @@ void Layout<OffsetVector, BlockDimensions>::init()
 			}
 		}
 	}
+
+	// The node look-up tables only depend on the block dimensions and the offsets
+	compute_strides(block_dimensions, block_dimension_strides);
+
+	vector<vector<ptrdiff_t> > shifts[NODES_PER_CELL];
+	vector<vector<ptrdiff_t> > block_edge[NODES_PER_CELL];
+
+	for (size_t c = 0; c < NODES_PER_CELL; c++)
+	{
+		// Compute node look-up tables
+		location_counts[c] = compute_offset_lut(block_dimensions, block_dimension_strides, offsets[c],
+			offset_strides[c], ranges[c], shifts[c]);
+
+		// Compute the corresponding block edge for every node edge
+		compute_block_edges(block_dimensions, offsets[c], offset_strides[c], ranges[c], location_counts[c],
+			block_offsets, block_edge[c]);
+	}
+	// Save total count of blocks
+	block_edge_count = block_offsets[0].size();
+
+	// Generate node edge mask for the node edges corresponding to every block edge
+	compute_node_edge_masks(block_edge, location_counts, node_edge_mask);
+
+	// Pack the shifts, block edges and sister edges together
+	compute_node_lookup(shifts, block_edge, edge_sister);
 }
 
 template <typename OffsetVector, typename BlockDimensions>
@@ -78,11 +105,13 @@ Layout<OffsetVector, BlockDimensions>::Layout(long dimensions[])
 	original_sizes[0] = NODES_PER_CELL;
 	sizes[0] = NODES_PER_CELL;
 	node_count = NODES_PER_CELL;
+	original_node_count = NODES_PER_CELL;
 	for (size_t i = 1; i < DIM_COUNT; i++)
 	{
 		original_sizes[i] = dimensions[i - 1];
 		sizes[i] = ceil((double)dimensions[i - 1] / block_dimensions[i]) * block_dimensions[i];
 		node_count *=  sizes[i];
+		original_node_count *= original_sizes[i];
 
 		// Warning: block dimension did not divide graph dimension
 		if (sizes[i] != dimensions[i - 1])
@@ -106,30 +135,16 @@ Layout<OffsetVector, BlockDimensions>::Layout(long dimensions[])
 	compute_strides(original_sizes, original_size_strides);
 	compute_strides(sizes, size_strides);
 	compute_strides(blocks_per_dim, block_strides);
-	compute_strides(block_dimensions, block_dimension_strides);
-
-	// For each cell index:
-	vector<ptrdiff_t> block_offsets[DIM_COUNT];
-
-	for (size_t c = 0; c < NODES_PER_CELL; c++)
-	{
-		// Compute node look-up tables
-		location_counts[c] = compute_offset_lut(block_dimensions, block_dimension_strides, offsets[c],
-			offset_strides[c], ranges[c], shifts[c]);
-
-		// Compute the corresponding block edge for every node edge
-		compute_block_edges(block_dimensions, offsets[c], offset_strides[c], ranges[c], location_counts[c],
-			block_offsets, block_edge[c]);
-	}
-	// Save total count of blocks
-	block_edge_count = block_offsets[0].size();
 
 	// Compute block look-up tables
-	compute_offset_lut(blocks_per_dim, block_strides, block_offsets,
-		block_offset_strides, block_ranges, block_shifts);
-
-	// Generate node edge mask for the node edges corresponding to every block edge
-	compute_node_edge_masks(block_edge, location_counts, node_edge_mask);
+	vector<vector<ptrdiff_t> > shifts;
+	size_t block_location_count = compute_offset_lut(blocks_per_dim, block_strides, block_offsets,
+		block_offset_strides, block_ranges, shifts);
+
+	block_shifts.resize(block_location_count * block_edge_count);
+	for (size_t l = 0; l < block_location_count; l++)
+		for (size_t be = 0; be < block_edge_count; be++)
+			block_shifts[l * block_edge_count + be] = shifts[l][be];
 }
 
 template <typename OffsetVector, typename BlockDimensions>
@@ -160,12 +175,46 @@ void Layout<OffsetVector, BlockDimensions>::compute_node_edge_masks(
 			for (size_t e = 0; e < edge_count_by_cell_index[c]; e++)
 			{
 				be = block_edge[c][l][e];
-				node_edge_mask[c][l][be] |= 1 << e;
+				node_edge_mask[c][l][be] |= (ptrdiff_t)1 << e;
 			}
 		}
 	}
 }
 
+template <typename OffsetVector, typename BlockDimensions>
+void Layout<OffsetVector, BlockDimensions>::compute_node_lookup(
+	vector<vector<ptrdiff_t> > shifts[], vector<vector<ptrdiff_t> > block_edge[],
+	ptrdiff_t edge_sister[][NODE_EDGE_COUNT])
+{
+	size_t lookup_count = 0;
+	for (size_t c = 0; c < NODES_PER_CELL; c++)
+	{
+		node_lookup_start[c] = lookup_count;
+		lookup_count += location_counts[c];
+	}
+
+	// Allocated once per layout type and shared by all its instances
+	char* memory = new char[lookup_count * sizeof(NodeLookup) + CACHE_LINE_SIZE];
+	node_lookup = (NodeLookup*)(((size_t)memory + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1));
+
+	NodeLookup* lookup = node_lookup;
+	for (size_t c = 0; c < NODES_PER_CELL; c++)
+	{
+		for (size_t l = 0; l < location_counts[c]; l++)
+		{
+			// Unused edges of cells with fewer edges are zeroed
+			for (size_t e = 0; e < NODE_EDGE_COUNT; e++)
+			{
+				bool used = e < edge_count_by_cell_index[c];
+				lookup->shift[e] = used ? (ShiftType)shifts[c][l][e] : 0;
+				lookup->block_edge[e] = used ? (BlockEdgeType)block_edge[c][l][e] : 0;
+				lookup->sister[e] = used ? (SisterType)edge_sister[c][e] : -1;
+			}
+			lookup++;
+		}
+	}
+}
+
 template <typename OffsetVector, typename BlockDimensions>
 void Layout<OffsetVector, BlockDimensions>::compute_block_edges(
 	ptrdiff_t shift_sizes[], vector<ptrdiff_t> offsets[], size_t offset_strides[],
@@ -320,7 +369,7 @@ unsigned long Layout<OffsetVector, BlockDimensions>::get_boundary_membership(Coo
 			pos = coord[d] + offsets[c][d][e];
 			if (pos < 0 || pos >= block_dimensions[d])
 			{
-				boundary |= 1 << e;
+				boundary |= 1UL << e;
 				break;
 			}
 		}
@@ -415,4 +464,19 @@ size_t Layout<OffsetVector, BlockDimensions>::get_node_id(size_t node_id)
 	return new_node_id;
 }
 
+template <typename OffsetVector, typename BlockDimensions>
+size_t Layout<OffsetVector, BlockDimensions>::get_complete_block_count(size_t node_id)
+{
+	// Blocks are ordered by layers along the slowest dimension, and edges never reach past
+	// the next layer, so a layer is complete once the nodes before node_id (in the original
+	// numbering) cover it and the layer after it
+	const size_t d = DIM_COUNT - 1;
+	size_t slices = node_id / original_size_strides[d];
+	if (slices >= (size_t)original_sizes[d])
+		return block_count;
+
+	size_t layers = slices / block_dimensions[d];
+	return (layers > 0) ? (layers - 1) * block_strides[d] : 0;
+}
+
 #endif
@@ -18,6 +18,8 @@ public:
 	typedef CapType _CapType;
 	typedef FlowType _FlowType;
 
+	virtual ~MaxflowSolver() {}
+
 	virtual void add_node(IdType nnodes) = 0;
 	virtual void add_edge(IdType node_i, IdType node_j, CapType cap, CapType rev_cap) = 0;
 	virtual void add_terminal_weights(IdType node_id, FlowType src_cap, FlowType snk_cap) = 0;
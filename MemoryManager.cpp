@@ -8,25 +8,52 @@
 #include "MemoryManager.h"
 
 #include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#ifdef _MSC_VER
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 using namespace std;
 
+#ifdef USE_NUMA
+#include <numa.h>
+#endif
+
 MemoryManager::MemoryManager(int64 space_size, int64 page_size, int resident_page_count = 0)
 {
 	this->page_size = page_size;
-	int page_count = (space_size + page_size - 1) / page_size;
+	page_count = (space_size + page_size - 1) / page_size;
 	timestamp = 0;
 
+	// Spread the pages over the NUMA nodes, but never give a node less than a page
+	node_count = 1;
+#ifdef USE_NUMA
+	if (numa_available() != -1)
+		node_count = numa_num_configured_nodes();
+#endif
+	if (node_count > page_count)
+		node_count = page_count;
+	if (node_count > resident_page_count)
+		node_count = resident_page_count;
+	if (node_count < 1)
+		node_count = 1;
+
 	resident.resize(resident_page_count);
 	for (int i = 0; i < resident.size(); i++)
 	{
+		// Resident pages are divided evenly between the nodes
+		resident[i].node = (int)((int64)i * node_count / resident_page_count);
 		try
 		{
-			resident[i].addr = new char[page_size];
+			resident[i].addr = allocate_page(resident[i].node);
 		}
 		catch (bad_alloc& ba)
 		{
 			for (int id = 0; id < i; id++)
-				delete[] resident[id].addr;
+				free_page(resident[id].addr);
 
 			cout << "Allocation failure. Try tweaking the BlocksPerMemoryPage and BlockDimensions parameters." << endl;
 			exit(1);
@@ -37,19 +64,49 @@ MemoryManager::MemoryManager(int64 space_size, int64 page_size, int resident_pag
 	}
 
 	page_table = new int[page_count];
-	for (int i = 0; i < page_count; i++)
+	for (int64 i = 0; i < page_count; i++)
 		page_table[i] = PAGE_NOT_FOUND;
 
 	mapped_before = new bool[page_count];
-	for (int i = 0; i < page_count; i++)
+	discarded = new bool[page_count];
+	for (int64 i = 0; i < page_count; i++)
+	{
 		mapped_before[i] = false;
+		discarded[i] = false;
+	}
+
+#ifdef USE_PAGE_COMPRESSION
+	stored_size = new int64[page_count];
+	for (int64 i = 0; i < page_count; i++)
+		stored_size[i] = page_size;
+	compressed = new char[page_size];
+#endif
 
 	// Create the memory mapped file
-	srand(time(0));
-	int random = (double)rand() / (RAND_MAX + 1) * 9999;
-	stringstream namestream;
-	namestream << "temp" << setfill('0') << setw(4) << random << ".mem";
-	name = namestream.str();
+	// Seed only once, so that managers created in the same second do not pick the same name,
+	// and create the file exclusively, so that a name taken by another manager or process in the meantime is skipped
+	static bool seeded = false;
+	if (!seeded)
+	{
+		srand(time(0));
+		seeded = true;
+	}
+	int fd;
+	do
+	{
+		int random = rand() / (RAND_MAX + 1.0) * 9999;
+		stringstream namestream;
+		namestream << "temp" << setfill('0') << setw(4) << random << ".mem";
+		name = namestream.str();
+		fd = open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+	} while (fd == -1 && errno == EEXIST);
+
+	if (fd == -1)
+	{
+		cout << "Could not create the temporary file " << name << ". Try another working directory." << endl;
+		exit(1);
+	}
+	close(fd);
 
 	handle = new fstream(name.c_str(), ios::in | ios::out | ios::binary | ios::trunc);
 }
@@ -58,8 +115,13 @@ MemoryManager::~MemoryManager()
 {
 	delete[] page_table;
 	delete[] mapped_before;
+	delete[] discarded;
+#ifdef USE_PAGE_COMPRESSION
+	delete[] stored_size;
+	delete[] compressed;
+#endif
 	for (int i = 0; i < resident.size(); i++)
-		delete[] resident[i].addr;
+		free_page(resident[i].addr);
 
 	delete handle;
 	filesys::remove(name);
@@ -68,17 +130,20 @@ MemoryManager::~MemoryManager()
 void* MemoryManager::add_ref(int64 addr)
 {
 	ResidentPage* page;
-	int page_id = addr / page_size;
+	int64 page_id = addr / page_size;
 	int64 offset = addr - page_id * page_size;
 
 	int resident_id = page_table[page_id];
 
 	if (resident_id == PAGE_NOT_FOUND)
 	{
-		// Find LRU resident page id
-		unsigned min_timestamp = timestamp + 1;
+		// Find LRU resident page id among the pages of the same node
+		int node = get_page_node(addr);
+		int64 min_timestamp = timestamp + 1;
 		for (int i = 0; i < resident.size(); i++)
 		{
+			if (resident[i].node != node)
+				continue;
 			if (resident[i].page_id == PAGE_NOT_FOUND)
 			{
 				resident_id = i;
@@ -96,7 +161,8 @@ void* MemoryManager::add_ref(int64 addr)
 			resident.resize(resident.size() + 1);
 
 			page = &resident[resident_id];
-			page->addr = new char[page_size];
+			page->addr = allocate_page(node);
+			page->node = node;
 		}
 		else
 		{
@@ -104,7 +170,13 @@ void* MemoryManager::add_ref(int64 addr)
 			if (page->page_id != PAGE_NOT_FOUND)
 			{
 				page_table[page->page_id] = PAGE_NOT_FOUND;
+#ifdef USE_TRACE
+				TraceBuffer::int64 start = TraceBuffer::now();
 				unmap(page);
+				trace.span("page_out", start, "page", (size_t)page->page_id);
+#else
+				unmap(page);
+#endif
 			}
 		}
 
@@ -112,8 +184,16 @@ void* MemoryManager::add_ref(int64 addr)
 		page->page_id = page_id;
 		page->ref_count = 0;
 
+#ifdef USE_TRACE
+		TraceBuffer::int64 start = TraceBuffer::now();
+#endif
 		if (mapped_before[page_id])
 			map(page);
+		else if (initializer)
+			initializer(page->addr, page_id * page_size, page_size);
+#ifdef USE_TRACE
+		trace.span(mapped_before[page_id] ? "page_in" : "page_init", start, "page", (size_t)page_id);
+#endif
 		mapped_before[page_id] = true;
 	}
 	else
@@ -127,7 +207,7 @@ void* MemoryManager::add_ref(int64 addr)
 
 void MemoryManager::remove_ref(int64 addr)
 {
-	int page_id = addr / page_size;
+	int64 page_id = addr / page_size;
 	int resident_id = page_table[page_id];
 
 	if (resident_id != PAGE_NOT_FOUND)
@@ -137,14 +217,48 @@ void MemoryManager::remove_ref(int64 addr)
 		if (page.ref_count < 0)
 			page.ref_count = 0;
 		page.lru_timestamp = ++timestamp;
+
+		if (page.ref_count == 0 && discarded[page_id])
+			release(resident_id);
 	}
 }
 
+void MemoryManager::discard(int64 addr)
+{
+	int64 page_id = addr / page_size;
+	int resident_id = page_table[page_id];
+	discarded[page_id] = true;
+
+	// A referenced page is released when its last reference is removed
+	if (resident_id != PAGE_NOT_FOUND && resident[resident_id].ref_count == 0)
+		release(resident_id);
+}
+
+void MemoryManager::release(int resident_id)
+{
+	// Free the resident slot for other pages, dropping its contents
+	ResidentPage& page = resident[resident_id];
+	page_table[page.page_id] = PAGE_NOT_FOUND;
+	page.page_id = PAGE_NOT_FOUND;
+	page.lru_timestamp = 0;
+}
+
 inline void MemoryManager::map(ResidentPage* page)
 {
 	int64 offset = page->page_id * page_size;
 	streampos pos = offset_to_position(offset);
 	handle->seekg(pos);
+
+#ifdef USE_PAGE_COMPRESSION
+	// Pages that did not compress are stored raw
+	int64 size = stored_size[page->page_id];
+	if (size != page_size)
+	{
+		handle->read(compressed, size);
+		decompress_page(compressed, size, page->addr);
+		return;
+	}
+#endif
 	handle->read(page->addr, page_size);
 }
 
@@ -153,5 +267,168 @@ inline void MemoryManager::unmap(ResidentPage* page)
 	int64 offset = page->page_id * page_size;
 	streampos pos = offset_to_position(offset);
 	handle->seekp(pos);
+
+#ifdef USE_PAGE_COMPRESSION
+	// Compressed pages keep their slot in the file, only fewer bytes are written
+	int64 size = compress_page(page->addr, compressed);
+	if (size != 0)
+	{
+		stored_size[page->page_id] = size;
+		handle->write(compressed, size);
+		return;
+	}
+	stored_size[page->page_id] = page_size;
+#endif
 	handle->write(page->addr, page_size);
 }
+
+void MemoryManager::set_page_initializer(PageInitializer initializer)
+{
+	this->initializer = initializer;
+}
+
+bool MemoryManager::is_touched(int64 addr)
+{
+	return mapped_before[addr / page_size];
+}
+
+#ifdef USE_PAGE_COMPRESSION
+// The codec works on 32-bit words, a control byte c < 128 is followed by c + 1 literal words,
+// otherwise it is followed by a single word repeated c - 127 times. Trailing bytes are copied.
+MemoryManager::int64 MemoryManager::compress_page(const char* page, char* out)
+{
+	const int MAX_RUN = 128;
+	int64 word_count = page_size / sizeof(unsigned);
+	const unsigned* words = (const unsigned*)page;
+	int64 size = 0;
+	int64 i = 0;
+
+	while (i < word_count)
+	{
+		// Count the repeats of the current word
+		int run = 1;
+		while (i + run < word_count && run < MAX_RUN && words[i + run] == words[i])
+			run++;
+
+		if (run > 1)
+		{
+			if (size + 1 + (int64)sizeof(unsigned) >= page_size)
+				return 0;
+			out[size++] = (char)(MAX_RUN - 1 + run);
+			memcpy(out + size, words + i, sizeof(unsigned));
+			size += sizeof(unsigned);
+			i += run;
+		}
+		else
+		{
+			// Collect literals until the next repeat
+			run = 1;
+			while (i + run < word_count && run < MAX_RUN &&
+				(i + run + 1 >= word_count || words[i + run] != words[i + run + 1]))
+				run++;
+
+			if (size + 1 + run * (int64)sizeof(unsigned) >= page_size)
+				return 0;
+			out[size++] = (char)(run - 1);
+			memcpy(out + size, words + i, run * sizeof(unsigned));
+			size += run * sizeof(unsigned);
+			i += run;
+		}
+	}
+
+	int64 tail = page_size - word_count * sizeof(unsigned);
+	if (size + tail >= page_size)
+		return 0;
+	memcpy(out + size, page + word_count * sizeof(unsigned), tail);
+	size += tail;
+
+	return size;
+}
+
+void MemoryManager::decompress_page(const char* in, int64 in_size, char* page)
+{
+	int64 word_count = page_size / sizeof(unsigned);
+	unsigned* words = (unsigned*)page;
+	int64 i = 0;
+	int64 pos = 0;
+
+	while (i < word_count)
+	{
+		unsigned char c = (unsigned char)in[pos++];
+		if (c < 128)
+		{
+			memcpy(words + i, in + pos, (c + 1) * sizeof(unsigned));
+			pos += (c + 1) * sizeof(unsigned);
+			i += c + 1;
+		}
+		else
+		{
+			unsigned value;
+			memcpy(&value, in + pos, sizeof(unsigned));
+			pos += sizeof(unsigned);
+			for (int r = 0; r < c - 127; r++)
+				words[i++] = value;
+		}
+	}
+
+	memcpy(page + word_count * sizeof(unsigned), in + pos, in_size - pos);
+}
+#endif
+
+#ifdef USE_TRACE
+const TraceBuffer& MemoryManager::get_trace()
+{
+	return trace;
+}
+#endif
+
+int MemoryManager::get_node_count()
+{
+	return node_count;
+}
+
+int MemoryManager::get_page_node(int64 addr)
+{
+	int64 page_id = addr / page_size;
+	return (int)(page_id * node_count / page_count);
+}
+
+void MemoryManager::run_on_node(int node)
+{
+	// A node of -1 lets the calling thread run anywhere again
+#ifdef USE_NUMA
+	if (node_count > 1)
+		numa_run_on_node(node);
+#else
+	(void)node; // there is a single node
+#endif
+}
+
+char* MemoryManager::allocate_page(int node)
+{
+#ifdef USE_NUMA
+	// Bind the page to its node, it is then placed there on first touch
+	if (node_count > 1)
+	{
+		char* addr = (char*)numa_alloc_onnode(page_size, node);
+		if (addr == NULL)
+			throw bad_alloc();
+		return addr;
+	}
+#else
+	(void)node; // there is a single node
+#endif
+	return new char[page_size];
+}
+
+void MemoryManager::free_page(char* addr)
+{
+#ifdef USE_NUMA
+	if (node_count > 1)
+	{
+		numa_free(addr, page_size);
+		return;
+	}
+#endif
+	delete[] addr;
+}
@@ -20,10 +20,17 @@ namespace filesys = boost::filesystem;
 #include <boost/iostreams/positioning.hpp>
 using namespace boost::iostreams;
 
+#include <boost/function.hpp>
+
+#ifdef USE_TRACE
+#include "TraceBuffer.h"
+#endif
+
 class MemoryManager
 {
 public:
 	typedef stream_offset int64;
+	typedef boost::function<void (char* page, int64 addr, int64 size)> PageInitializer;
 	static const int PAGE_NOT_FOUND = -1;
 
 private:
@@ -31,27 +38,69 @@ private:
 	{
 		char* addr;
 		int ref_count;
-		unsigned lru_timestamp;
-		int page_id;
+		int64 lru_timestamp;
+		int64 page_id;
+		int node;
 	};
 
 	fstream *handle;
 	string name;
-	int *page_table;
+	int *page_table; // resident index of every page
 	bool *mapped_before;
+	bool *discarded;
 	int64 page_size;
-	unsigned timestamp;
+	int64 page_count;
+	int node_count;
+	int64 timestamp;
 	deque<ResidentPage> resident;
+	PageInitializer initializer;
+
+#ifdef USE_PAGE_COMPRESSION
+	// Compressed page index, the stored size of every page in its slot of the file
+	int64 *stored_size;
+	char *compressed;
+#endif
+
+#ifdef USE_TRACE
+	// Page-ins and page-outs, serialized like every other call by the caller
+	TraceBuffer trace;
+#endif
 
+	void release(int resident_id);
 	void map(ResidentPage* page);
 	void unmap(ResidentPage* page);
 
+#ifdef USE_PAGE_COMPRESSION
+	// Run-length page codec, returns 0 if the page does not compress
+	int64 compress_page(const char* page, char* out);
+	void decompress_page(const char* in, int64 in_size, char* page);
+#endif
+
+	char* allocate_page(int node);
+	void free_page(char* addr);
+
 public:
 	MemoryManager(int64 space_size, int64 page_size, int resident_page_count);
 	~MemoryManager();
 
 	void* add_ref(int64 addr);
 	void remove_ref(int64 addr);
+
+	// Pages are built by the initializer when first referenced, and never stored before that
+	void set_page_initializer(PageInitializer initializer);
+	bool is_touched(int64 addr);
+
+	// Discarded pages are dropped without being written back, and must not be referenced again
+	void discard(int64 addr);
+
+	// NUMA placement, pages are split into contiguous ranges, one per node
+	int get_node_count();
+	int get_page_node(int64 addr);
+	void run_on_node(int node);
+
+#ifdef USE_TRACE
+	const TraceBuffer& get_trace();
+#endif
 };
 
 #endif
@@ -0,0 +1,139 @@
+/////////////////////////////////////////////////////////////////////////////
+// Filename: NarrowResidualsTest.cpp
+// Author:   Sameh Khamis
+//
+// Description: Checks the flow with narrow residuals and large capacities
+//              against a simple reference, build with "make test"
+/////////////////////////////////////////////////////////////////////////////
+#include <iostream>
+#include <cstdlib>
+#include <vector>
+#include <queue>
+using namespace std;
+
+#include "RegionPushRelabel.h"
+
+typedef Array<
+	Arc<0, 0, Offsets<1, 0> >,
+	Arc<0, 0, Offsets<-1, 0> >,
+	Arc<0, 0, Offsets<0, 1> >,
+	Arc<0, 0, Offsets<0, -1> >
+> FourConnected;
+
+typedef RegionPushRelabel<
+	int, long long,
+	Layout<
+		FourConnected,
+		BlockDimensions<8, 8>
+	>,
+	ThreadCount<2>
+> RegularGraph;
+
+// Breadth-first augmenting paths on an adjacency list
+class ReferenceGraph
+{
+public:
+	ReferenceGraph(int n) : adjacent(n) {}
+
+	void add_edge(int i, int j, long long cap, long long rev_cap)
+	{
+		adjacent[i].push_back(to.size()); to.push_back(j); residual.push_back(cap);
+		adjacent[j].push_back(to.size()); to.push_back(i); residual.push_back(rev_cap);
+	}
+
+	long long compute_maxflow(int s, int t)
+	{
+		long long flow = 0;
+		vector<int> parent(adjacent.size());
+		while (true)
+		{
+			// Edges are added in pairs, so the reverse of edge k is edge k ^ 1
+			parent.assign(adjacent.size(), -1);
+			queue<int> q;
+			q.push(s);
+			while (!q.empty() && parent[t] == -1)
+			{
+				int i = q.front();
+				q.pop();
+				for (size_t k = 0; k < adjacent[i].size(); k++)
+				{
+					int e = adjacent[i][k];
+					if (residual[e] > 0 && parent[to[e]] == -1 && to[e] != s)
+					{
+						parent[to[e]] = e;
+						q.push(to[e]);
+					}
+				}
+			}
+			if (parent[t] == -1)
+				return flow;
+
+			long long delta = residual[parent[t]];
+			for (int i = t; i != s; i = to[parent[i] ^ 1])
+				delta = min(delta, residual[parent[i]]);
+			for (int i = t; i != s; i = to[parent[i] ^ 1])
+			{
+				residual[parent[i]] -= delta;
+				residual[parent[i] ^ 1] += delta;
+			}
+			flow += delta;
+		}
+	}
+
+private:
+	vector<vector<int> > adjacent;
+	vector<int> to;
+	vector<long long> residual;
+};
+
+int main()
+{
+	// Every edge pair of the grid is wide, so most of them do not fit in the overflow tables of their blocks
+	const int width = 48, height = 40, max_cap = 200000;
+	int failed = 0;
+
+	for (int seed = 0; seed < 4; seed++)
+	{
+		long d[] = {width, height};
+		RegularGraph *g = new RegularGraph(d);
+		int n = width * height;
+		ReferenceGraph r(n + 2);
+		srand(seed);
+
+		for (int y = 0; y < height; y++)
+			for (int x = 0; x < width; x++)
+			{
+				int i = y * width + x;
+				int source = rand() % max_cap, sink = rand() % max_cap;
+				g->add_terminal_weights(i, source, sink);
+				r.add_edge(n, i, source, 0);
+				r.add_edge(i, n + 1, sink, 0);
+
+				if (x + 1 < width)
+				{
+					int cap = rand() % max_cap, rev_cap = rand() % max_cap;
+					g->add_edge(i, i + 1, cap, rev_cap);
+					r.add_edge(i, i + 1, cap, rev_cap);
+				}
+				if (y + 1 < height)
+				{
+					int cap = rand() % max_cap, rev_cap = rand() % max_cap;
+					g->add_edge(i, i + width, cap, rev_cap);
+					r.add_edge(i, i + width, cap, rev_cap);
+				}
+			}
+
+		g->compute_maxflow();
+		long long flow = r.compute_maxflow(n, n + 1);
+		if (g->get_flow() != flow)
+		{
+			cout << "Seed " << seed << ": flow = " << g->get_flow() << ", expected " << flow << endl;
+			failed++;
+		}
+
+		delete g;
+	}
+
+	cout << (failed ? "FAILED" : "PASSED") << endl;
+	return failed;
+}
@@ -0,0 +1,143 @@
+/////////////////////////////////////////////////////////////////////////////
+// Filename: ParametricTest.cpp
+// Author:   Sameh Khamis
+//
+// Description: Checks the flow and cut of every lambda of the parametric
+//              solve against separate solves, build with "make test"
+/////////////////////////////////////////////////////////////////////////////
+#include <iostream>
+#include <cstdlib>
+#include <vector>
+using namespace std;
+
+#include "RegionPushRelabel.h"
+
+typedef Array<
+	Arc<0, 0, Offsets<1, 0> >,
+	Arc<0, 0, Offsets<-1, 0> >,
+	Arc<0, 0, Offsets<0, 1> >,
+	Arc<0, 0, Offsets<0, -1> >
+> FourConnected;
+
+typedef RegionPushRelabel<
+	int, long long,
+	Layout<
+		FourConnected,
+		BlockDimensions<8, 8>
+	>,
+	ThreadCount<2>
+> RegularGraph;
+
+// Source capacities grow and sink capacities shrink with lambda
+struct TerminalWeights
+{
+	vector<int> source, sink, slope;
+
+	void operator()(size_t i, int lambda, long long& src_cap, long long& snk_cap) const
+	{
+		src_cap = source[i] + lambda * slope[i];
+		snk_cap = max(sink[i] - lambda, 0);
+	}
+};
+
+struct Edge
+{
+	int i, j, cap, rev_cap;
+};
+
+int main()
+{
+	const int lambda_count = 8;
+	int failed = 0;
+
+	for (int seed = 0; seed < 6; seed++)
+	{
+		// Sizes that are not a multiple of the block size leave some blocks partly empty
+		int width = 13 + seed * 7, height = 9 + seed * 5;
+		int n = width * height;
+		long d[] = {width, height};
+		srand(seed);
+
+		TerminalWeights weights;
+		for (int i = 0; i < n; i++)
+		{
+			weights.source.push_back(rand() % 10);
+			weights.sink.push_back(rand() % 30);
+			weights.slope.push_back(rand() % 4);
+		}
+
+		vector<Edge> edges;
+		for (int y = 0; y < height; y++)
+			for (int x = 0; x < width; x++)
+			{
+				int i = y * width + x;
+				if (x + 1 < width)
+				{
+					Edge e = { i, i + 1, rand() % 10, rand() % 10 };
+					edges.push_back(e);
+				}
+				if (y + 1 < height)
+				{
+					Edge e = { i, i + width, rand() % 10, rand() % 10 };
+					edges.push_back(e);
+				}
+			}
+
+		vector<int> lambdas;
+		for (int k = 0; k < lambda_count; k++)
+			lambdas.push_back(k);
+
+		RegularGraph *g = new RegularGraph(d);
+		for (size_t e = 0; e < edges.size(); e++)
+			g->add_edge(edges[e].i, edges[e].j, edges[e].cap, edges[e].rev_cap);
+		vector<long long> flows;
+		vector<size_t> cuts;
+		g->compute_parametric_maxflow(lambdas, weights, flows, cuts);
+		delete g;
+
+		for (int k = 0; k < lambda_count; k++)
+		{
+			// Solve the same lambda from scratch
+			RegularGraph *cold = new RegularGraph(d);
+			vector<long long> src_caps(n), snk_caps(n);
+			for (int i = 0; i < n; i++)
+			{
+				weights(i, lambdas[k], src_caps[i], snk_caps[i]);
+				cold->add_terminal_weights(i, src_caps[i], snk_caps[i]);
+			}
+			for (size_t e = 0; e < edges.size(); e++)
+				cold->add_edge(edges[e].i, edges[e].j, edges[e].cap, edges[e].rev_cap);
+			cold->compute_maxflow();
+			long long flow = cold->get_flow();
+			delete cold;
+
+			if (flows[k] != flow)
+			{
+				cout << "Seed " << seed << ", lambda " << k << ": flow = " << flows[k] << ", expected " << flow << endl;
+				failed++;
+			}
+
+			// The source set of the lambda must be a minimum cut, so its capacity is the flow
+			long long cut = 0;
+			for (int i = 0; i < n; i++)
+				cut += (cuts[i] <= (size_t)k) ? snk_caps[i] : src_caps[i];
+			for (size_t e = 0; e < edges.size(); e++)
+			{
+				bool source_i = cuts[edges[e].i] <= (size_t)k, source_j = cuts[edges[e].j] <= (size_t)k;
+				if (source_i && !source_j)
+					cut += edges[e].cap;
+				else if (!source_i && source_j)
+					cut += edges[e].rev_cap;
+			}
+
+			if (cut != flow)
+			{
+				cout << "Seed " << seed << ", lambda " << k << ": cut = " << cut << ", expected " << flow << endl;
+				failed++;
+			}
+		}
+	}
+
+	cout << (failed ? "FAILED" : "PASSED") << endl;
+	return failed;
+}
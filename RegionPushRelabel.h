@@ -11,10 +11,11 @@
 #define _REGION_PUSH_RELABEL
 
 #include <boost/thread.hpp>
+#include <boost/atomic.hpp>
 #include <boost/static_assert.hpp>
 using namespace boost;
 
-#define BOOST_PARAMETER_MAX_ARITY 7
+#define BOOST_PARAMETER_MAX_ARITY 9
 
 #include <boost/parameter/name.hpp>
 #include <boost/parameter/parameters.hpp>
@@ -24,6 +25,8 @@ namespace param = boost::parameter;
 #include <functional>
 #include <queue>
 #include <list>
+#include <map>
+#include <limits>
 using namespace std;
 
 #include "MaxflowSolver.h"
@@ -32,11 +35,21 @@ using namespace std;
 #include "DoublyLinkedArray.h"
 #include "Layout.h"
 
+#ifdef USE_TRACE
+#include "TraceBuffer.h"
+#endif
+
+// Edges per overflow table slot of a block with narrow residuals
+#if defined(USE_NARROW_RESIDUALS) && !defined(NARROW_OVERFLOW_SHARE)
+#define NARROW_OVERFLOW_SHARE 16
+#endif
+
 // Class has 5 required parameters:
 // 2 required positional parameters: capacity type and flow type (must be first two)
 // 1 required keyword parameter: Layout
-// Class also has 6 optional parameters for configuration, all keyword:
-// ThreadCount, MaxBlocksPerRegion, DischargesPerBlock, BucketDensity, BlocksPerMemoryPage, GlobalUpdateFrequency
+// Class also has 8 optional parameters for configuration, all keyword:
+// ThreadCount, MaxBlocksPerRegion, DischargesPerBlock, BucketDensity, BlocksPerMemoryPage, GlobalUpdateFrequency,
+// BlockScheduling, RegionSolver
 
 // Template parameter definition using boost parameter
 BOOST_PARAMETER_TEMPLATE_KEYWORD(param_layout)
@@ -46,6 +59,8 @@ BOOST_PARAMETER_TEMPLATE_KEYWORD(param_discharges_per_block)
 BOOST_PARAMETER_TEMPLATE_KEYWORD(param_bucket_density)
 BOOST_PARAMETER_TEMPLATE_KEYWORD(param_blocks_per_memory_page)
 BOOST_PARAMETER_TEMPLATE_KEYWORD(param_global_update_frequency)
+BOOST_PARAMETER_TEMPLATE_KEYWORD(param_block_scheduling)
+BOOST_PARAMETER_TEMPLATE_KEYWORD(param_region_solver)
 
 // Parameter signature class
 typedef param::parameters<
@@ -55,24 +70,26 @@ typedef param::parameters<
 	param::optional<param::deduced<tag::param_discharges_per_block>, is_base_and_derived<DischargesPerBlockTag, mpl::_> >,
 	param::optional<param::deduced<tag::param_bucket_density>, is_base_and_derived<BucketDensityTag, mpl::_> >,
 	param::optional<param::deduced<tag::param_blocks_per_memory_page>, is_base_and_derived<BlocksPerMemoryPageTag, mpl::_> >,
-	param::optional<param::deduced<tag::param_global_update_frequency>, is_base_and_derived<GlobalUpdateFrequencyTag, mpl::_> >
+	param::optional<param::deduced<tag::param_global_update_frequency>, is_base_and_derived<GlobalUpdateFrequencyTag, mpl::_> >,
+	param::optional<param::deduced<tag::param_block_scheduling>, is_base_and_derived<BlockSchedulingTag, mpl::_> >,
+	param::optional<param::deduced<tag::param_region_solver>, is_base_and_derived<RegionSolverTag, mpl::_> >
 > RegionPushRelabelParameters;
 
 // Grid Push Relabel class
 template <typename CapType, typename FlowType,
 	typename A0 = param::void_, typename A1 = param::void_, typename A2 = param::void_,
 	typename A3 = param::void_, typename A4 = param::void_, typename A5 = param::void_,
-	typename A6 = param::void_>
+	typename A6 = param::void_, typename A7 = param::void_, typename A8 = param::void_>
 class RegionPushRelabel : public MaxflowSolver<size_t, CapType, FlowType>
 {
 private:
 	// Template parameter extraction
-	typedef typename RegionPushRelabelParameters::bind<A0, A1, A2, A3, A4, A5, A6>::type Arguments;
+	typedef typename RegionPushRelabelParameters::bind<A0, A1, A2, A3, A4, A5, A6, A7, A8>::type Arguments;
 
 	typedef typename param::binding<Arguments, tag::param_layout>::type Layout;
 
 	typedef ThreadCount<1> DefaultThreadCount;
-	static const char THREAD_COUNT = (char)param::binding<Arguments, tag::param_thread_count, DefaultThreadCount>::type::value;
+	static const int THREAD_COUNT = (int)param::binding<Arguments, tag::param_thread_count, DefaultThreadCount>::type::value;
 
 	typedef MaxBlocksPerRegion<mpl::size<typename Layout::OffsetVector_>::value + 1> DefaultMaxBlocksPerRegion;
 	static const size_t MAX_BLOCKS_PER_REGION = param::binding<Arguments, tag::param_max_blocks_per_region, DefaultMaxBlocksPerRegion>::type::value;
@@ -89,30 +106,77 @@ private:
 	typedef GlobalUpdateFrequency<200> DefaultGlobalUpdateFrequency;
 	static const size_t GLOBAL_UPDATE_FREQUENCY = param::binding<Arguments, tag::param_global_update_frequency, DefaultGlobalUpdateFrequency>::type::value;
 
+	typedef BlockScheduling<FifoScheduling> DefaultBlockScheduling;
+	static const size_t BLOCK_SCHEDULING = param::binding<Arguments, tag::param_block_scheduling, DefaultBlockScheduling>::type::value;
+
+	typedef RegionSolver<PushRelabelSolver> DefaultRegionSolver;
+	static const size_t REGION_SOLVER = param::binding<Arguments, tag::param_region_solver, DefaultRegionSolver>::type::value;
+
 	// More constants
 	static const size_t BUCKET_DENSITY_BITS = log_n<BUCKET_DENSITY, 2>::value;
 	static const size_t MAX_RELABELS_PER_BLOCK = max_of<Layout::NODES_PER_BLOCK, DISCHARGES_PER_BLOCK>::value;
 	static const size_t LOCAL_WORK_THRESHOLD = MAX_BLOCKS_PER_REGION * DISCHARGES_PER_BLOCK * GLOBAL_UPDATE_FREQUENCY;
+#ifdef USE_ADAPTIVE_REGIONS
+	// Lower bound of the runtime discharge budget, and the share of stuck nodes (1 / STUCK_SHARE) that grows a region
+	static const size_t MIN_DISCHARGES_PER_BLOCK = max_of<DISCHARGES_PER_BLOCK / 16, 1>::value;
+	static const size_t STUCK_SHARE = 4;
+#endif
 
 	// Data type definitions
 	typedef pair<size_t, size_t> IntegerPair;
 
+	// Block owners are thread ids, kept to a byte per block unless there are too many threads
+	typedef typename mpl::if_c<(THREAD_COUNT < 127), signed char, short>::type OwnerType;
+
+#ifdef USE_NARROW_RESIDUALS
+	// Residuals are kept in a byte. The edge pairs whose residuals can reach RESIDUAL_ESCAPE keep theirs in the
+	// overflow table of their block, while the byte holds the residual capped at RESIDUAL_ESCAPE
+	BOOST_STATIC_ASSERT(numeric_limits<CapType>::is_integer);
+	typedef unsigned char ResidualType;
+	static const ResidualType RESIDUAL_ESCAPE = 255;
+
+	// Wide edges of a node, bits = Layout::NODE_EDGE_COUNT
+	typedef typename mpl::if_c<(Layout::NODE_EDGE_COUNT <= 8), unsigned char,
+		typename mpl::if_c<(Layout::NODE_EDGE_COUNT <= 16), unsigned short, unsigned long>::type>::type WideMask;
+
+	// One slot for every NARROW_OVERFLOW_SHARE edges, rounded up to a power of two and filled up to three quarters.
+	// The wide edges that do not fit spill to a map of the block kept outside of the pages
+	static const size_t OVERFLOW_SLOTS = pow_n<2, log_n<Layout::NODES_PER_BLOCK * Layout::NODE_EDGE_COUNT / NARROW_OVERFLOW_SHARE, 2>::value + 1>::value;
+	static const size_t OVERFLOW_LIMIT = OVERFLOW_SLOTS / 4 * 3;
+
+	struct OverflowEntry
+	{
+		unsigned key; // node index * Layout::NODE_EDGE_COUNT + edge + 1, 0 for an empty slot
+		CapType value;
+	};
+#else
+	typedef CapType ResidualType;
+#endif
+
 	// Node definition
 	struct Node
 	{
 		size_t distance;
 		FlowType preflow;
-		CapType residual[Layout::NODE_EDGE_COUNT];
+		unsigned long boundary; // bits = Layout::block_edge_count
+
+		// The small fields follow the residuals to pack with them
+		ResidualType residual[Layout::NODE_EDGE_COUNT];
 		unsigned char cur_edge;
 		unsigned char cell_index;
 		unsigned short location_index;
-		unsigned long boundary; // bits = Layout::block_edge_count
 		bool relabel;
-
-		bool is_active() { return preflow > 0 && distance < layout->node_count; }
+#ifdef USE_NARROW_RESIDUALS
+		WideMask wide;
+#endif
 	};
 
-	typedef FixedArray<unsigned, Layout::NODES_PER_BLOCK> ActiveList;
+	typedef FixedArray<typename Layout::NodeIndexType, Layout::NODES_PER_BLOCK> ActiveList;
+
+	// Compact look-up table entry types
+	typedef typename Layout::ShiftType ShiftType;
+	typedef typename Layout::BlockEdgeType BlockEdgeType;
+	typedef typename Layout::SisterType SisterType;
 
 	// Block definition
 	struct Block
@@ -121,17 +185,42 @@ private:
 		unsigned char cur_edge;
 		unsigned char region_id;
 		bool list_populated;
-		unsigned id;
+		size_t id;
 		size_t discharges;
+		size_t max_distance; // no node below the unreachable distance is labeled higher
 
 		ActiveList active;
 		Node nodes[Layout::NODES_PER_BLOCK];
 
+#ifdef USE_NARROW_RESIDUALS
+		size_t overflow_count;
+		OverflowEntry overflow[OVERFLOW_SLOTS];
+#endif
+
 		bool is_active() { return !active.empty(); }
 	};
 
 	static const MemoryManager::int64 BLOCK_SIZE = sizeof(Block);
 
+	// Owner of the blocks whose data is still being streamed in
+	static const OwnerType BLOCK_LOADING = -2;
+
+	// Page initializer for the memory manager
+	struct BlockInitializer
+	{
+		RegionPushRelabel* graph;
+		void operator()(char* page, MemoryManager::int64 addr, MemoryManager::int64 size) { graph->initialize_page(page, addr, size); }
+	};
+
+	// Flow sent over a region border, applied after the receiving block is next reserved
+	struct Mail
+	{
+		size_t block_id;
+		unsigned node_id;
+		SisterType sister;
+		CapType delta;
+	};
+
 	// Node compare function for priority queue
 	struct NodeCompare : public binary_function<Node*, Node*, bool>
 	{
@@ -152,31 +241,69 @@ private:
 		IntegerPair* relabels_iter;
 
 		FlowType flow_to_sink;
-		char thread_id;
+		OwnerType thread_id;
+		int node;
 		size_t region_discharges;
 		unsigned region_size;
+		unsigned region_limit; // blocks reserved per region, at most MAX_BLOCKS_PER_REGION
+		size_t discharge_budget; // discharges per block and pass, at most DISCHARGES_PER_BLOCK
+#ifdef USE_ADAPTIVE_REGIONS
+		size_t visit_count, stuck_count;
+		size_t seen_gap_relabels;
+#endif
+		size_t seen_complete;
 		Block* cur_block;
 		Block** cur_neighbors;
+		IntegerPair* cur_remote;
+		size_t* cur_ghosts;
 
 		Block* region[MAX_BLOCKS_PER_REGION];
 		vector<Block*> neighbors[MAX_BLOCKS_PER_REGION];
+		vector<IntegerPair> remote_neighbors[MAX_BLOCKS_PER_REGION]; // id and epoch of blocks of other regions
+		vector<size_t> ghost_labels[MAX_BLOCKS_PER_REGION]; // labels across the region border, by node and edge
+		vector<Mail> inbox[MAX_BLOCKS_PER_REGION];
+		vector<Mail> outbox;
+#ifdef USE_TRACE
+		TraceBuffer trace;
+#endif
 		vector<unsigned long> boundary_mask[MAX_BLOCKS_PER_REGION][Layout::NODES_PER_CELL]; // bits = Layout::NODE_EDGE_COUNT
 
 		deque<Node*> bucket_1[MAX_BLOCKS_PER_REGION];
 		deque<Node*> bucket_2[MAX_BLOCKS_PER_REGION];
 		priority_queue<Node*, deque<Node*>, NodeCompare> fixed[MAX_BLOCKS_PER_REGION];
 
+		// Augmenting path solver, the next edge to search from every node of the region and the path found
+		struct PathStep
+		{
+			Block* block;
+			Node* node;
+			unsigned char edge;
+			SisterType sister;
+			Block* next_block;
+			Node* next_node;
+		};
+		vector<unsigned char> search_edge;
+		vector<PathStep> path;
+		bool augment_pending;
+
 		void find_next_relabel_distance(size_t& distance, deque<Node*>* bucket, priority_queue<Node*, deque<Node*>, NodeCompare>* fixed);
 
 		void discharge_region();
+		void augment_region();
+		bool augment_paths();
+		bool find_path(Block* block, Node* source);
 		void gap_relabel();
 		void relabel_region();
 		void discharge();
 		bool relabel(Node* node);
 		bool is_region_discharged();
+#ifdef USE_ADAPTIVE_REGIONS
+		void adapt_region();
+		void adapt_discharge_budget();
+#endif
 
 	public:
-		RegionWorker(RegionPushRelabel* g, char id);
+		RegionWorker(RegionPushRelabel* g, OwnerType id);
 		~RegionWorker();
 		void work_loop();
 	};
@@ -184,6 +311,10 @@ private:
 	// Shared variables
 	mutex active_mutex;
 	DoublyLinkedArray<size_t>* active;
+	vector<Mail>* mailboxes; // only accessed under active_mutex
+#ifdef USE_NARROW_RESIDUALS
+	map<unsigned, CapType>* overflow_spill; // only grown while adding edges
+#endif
 
 	mutex busy_mutex;
 	condition_variable gap_cond;
@@ -196,14 +327,30 @@ private:
 	size_t* label_counts;
 	bool gap_found;
 	vector<size_t> possible_gaps;
-	unsigned* gaps;
+#ifdef USE_ADAPTIVE_REGIONS
+	size_t gap_relabel_count;
+#endif
+	size_t* gaps;
 	size_t* active_count;
+
+	// Block summaries for the scheduling policy
+	FlowType* block_excess;
+	size_t* block_label;
 	size_t max_bucket;
 
+	// Streaming construction, blocks are handed to the workers once their data is complete
+	thread_group* stream_threads;
+	bool loading;
+	size_t complete_count;
+
 	// Main variables
 	Layout* layout;
 	MemoryManager* memory;
-	char* block_owner;
+	OwnerType* block_owner;
+	atomic<size_t>* block_epoch; // reservations of every block, bumped under active_mutex and read by workers without it
+	bool* block_resolved;
+	unsigned* page_resolved_count;
+	Block* resolved_block;
 	unsigned short* block_location_index;
 	RegionWorker* workers[THREAD_COUNT];
 	FlowType flow;
@@ -213,15 +360,30 @@ private:
 	void update_data_sync(RegionWorker& worker);
 	void update_region_sync(RegionWorker& worker);
 	void wait_for_gap_relabeling();
-	void wait_for_work();
+	void wait_for_work(RegionWorker& worker);
+	void solve();
 	void update_block_gaps();
 
-	void initialize_block(size_t i);
+	void initialize_page(char* page, MemoryManager::int64 addr, MemoryManager::int64 size);
+	void initialize_block(Block* block, size_t i);
 	void populated_active_list(Block* block);
+	void apply_mailbox(Block* block, RegionWorker& worker);
+	void read_ghost_labels(RegionWorker& worker, unsigned region_index);
+	void update_terminal_weights(size_t node_id, FlowType src_delta, FlowType snk_delta);
+	void update_block_summary(Block* block);
+	bool is_block_resolved(Block* block);
+	size_t get_block_priority(size_t i);
 
 	Block* load_block(size_t i);
 	void unload_block(size_t i);
 
+	CapType get_residual(Block* block, Node* node, size_t e);
+	void add_residual(Block* block, Node* node, size_t e, FlowType delta);
+	void store_residual(Block* block, Node* node, size_t e, CapType value, FlowType pair);
+#ifdef USE_NARROW_RESIDUALS
+	CapType& get_overflow(Block* block, Node* node, size_t e);
+#endif
+
 public:
 	RegionPushRelabel(long dimensions[]);
 	~RegionPushRelabel();
@@ -230,56 +392,152 @@ public:
 	void add_edge(size_t node_i, size_t node_j, CapType cap, CapType rev_cap);
 	void add_terminal_weights(size_t node_id, FlowType src_cap, FlowType snk_cap);
 
+	void start_maxflow();
+	void mark_loaded(size_t node_id);
 	void compute_maxflow();
 	FlowType get_flow();
+
+	// Parametric maxflow: solves for all the lambdas in increasing order, reusing the flow and labels in between.
+	// weights(node_id, lambda, src_cap, snk_cap) sets the terminal capacities of a node, which must be
+	// non-decreasing (source) and non-increasing (sink) in lambda, so that the source sets are nested.
+	// flows gets the flow for every lambda, and cuts gets, for every node, the index of the first lambda
+	// that puts it on the source side (lambdas.size() if none)
+	template <typename LambdaType, typename WeightFunction>
+	void compute_parametric_maxflow(const vector<LambdaType>& lambdas, WeightFunction weights,
+		vector<FlowType>& flows, vector<size_t>& cuts);
 	void add_constant_to_flow(CapType amount);
 	int get_segment(size_t id);
+
+#ifdef USE_TRACE
+	// Writes the events recorded by the workers and the memory manager so far, in the Chrome trace-event format
+	void dump_trace(const string& filename);
+#endif
 };
 
 // Inline functions
-template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
-INLINE FlowType RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::get_flow()
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+INLINE FlowType RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::get_flow()
 {
 	return flow;
 }
 
-template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
-INLINE void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::add_constant_to_flow(CapType amount)
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+INLINE void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::add_constant_to_flow(CapType amount)
 {
 	flow += amount;
 }
 
-template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
-INLINE void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::add_node(size_t unused_nnodes)
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+INLINE void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::add_node(size_t unused_nnodes)
 {
 	// Do nothing!
 }
 
-template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
-INLINE int RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::get_segment(size_t id)
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+INLINE int RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::get_segment(size_t id)
 {
 	id = layout->get_node_id(id);
 
 	size_t bi, ni;
 	layout->get_node_block_index(id, bi, ni);
+
+	// Released blocks only hold unreachable nodes
+	if (block_resolved[bi])
+		return 0;
+
 	Node& node = load_block(bi)->nodes[ni];
 	int segment = ((node.distance) < (gaps[bi])) ? 1 : 0;
 	unload_block(bi);
 	return segment;
 }
 
-template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
-INLINE typename RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::Block* RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::load_block(size_t i)
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+INLINE typename RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::Block* RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::load_block(size_t i)
 {
 	return (Block*)memory->add_ref(i * BLOCK_SIZE);
 }
 
-template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
-INLINE void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::unload_block(size_t i)
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+INLINE void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::unload_block(size_t i)
 {
 	memory->remove_ref(i * BLOCK_SIZE);
 }
 
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+INLINE CapType RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::get_residual(Block* block, Node* node, size_t e)
+{
+#ifdef USE_NARROW_RESIDUALS
+	if (node->residual[e] == RESIDUAL_ESCAPE)
+		return get_overflow(block, node, e);
+#endif
+	return node->residual[e];
+}
+
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+INLINE void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::add_residual(Block* block, Node* node, size_t e, FlowType delta)
+{
+#ifdef USE_NARROW_RESIDUALS
+	if (node->wide & ((WideMask)1 << e))
+	{
+		CapType& value = get_overflow(block, node, e);
+		value += delta;
+		node->residual[e] = (ResidualType)min(value, (CapType)RESIDUAL_ESCAPE);
+		return;
+	}
+#endif
+	node->residual[e] += delta;
+}
+
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+INLINE void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::store_residual(Block* block, Node* node, size_t e, CapType value, FlowType pair)
+{
+#ifdef USE_NARROW_RESIDUALS
+	// The residuals of an edge pair only move between its two edges, so the pair stays narrow if their sum is
+	if (pair >= RESIDUAL_ESCAPE && !(node->wide & ((WideMask)1 << e)))
+	{
+		unsigned key = (unsigned)((node - block->nodes) * Layout::NODE_EDGE_COUNT + e + 1);
+		if (block->overflow_count == OVERFLOW_LIMIT)
+			overflow_spill[block->id][key] = 0;
+		else
+		{
+			size_t slot = (key * 2654435761u) & (OVERFLOW_SLOTS - 1);
+			while (block->overflow[slot].key != 0)
+				slot = (slot + 1) & (OVERFLOW_SLOTS - 1);
+
+			block->overflow[slot].key = key;
+			block->overflow_count++;
+		}
+		node->wide |= (WideMask)1 << e;
+	}
+
+	if (node->wide & ((WideMask)1 << e))
+	{
+		get_overflow(block, node, e) = value;
+		node->residual[e] = (ResidualType)min(value, (CapType)RESIDUAL_ESCAPE);
+		return;
+	}
+#endif
+	node->residual[e] = (ResidualType)value;
+}
+
+#ifdef USE_NARROW_RESIDUALS
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+INLINE CapType& RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::get_overflow(Block* block, Node* node, size_t e)
+{
+	// Open addressing with linear probing, entries are never removed and wide edges always have one. The table
+	// always has an empty slot, which ends the search for the edges that spilled
+	unsigned key = (unsigned)((node - block->nodes) * Layout::NODE_EDGE_COUNT + e + 1);
+	size_t slot = (key * 2654435761u) & (OVERFLOW_SLOTS - 1);
+	while (block->overflow[slot].key != key)
+	{
+		if (block->overflow[slot].key == 0)
+			return overflow_spill[block->id].find(key)->second;
+		slot = (slot + 1) & (OVERFLOW_SLOTS - 1);
+	}
+	return block->overflow[slot].value;
+}
+#endif
+
 #include "RegionPushRelabel.tpl"
 
 #endif
@@ -17,46 +17,78 @@
 // RegionPushRelabel
 //////////////////////
 
-template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
-RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::RegionPushRelabel(long dimensions[])
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::RegionPushRelabel(long dimensions[])
 {
 	// Initialize layout offsets
 	layout = new Layout(dimensions);
 	bucket_count = (layout->node_count + BUCKET_DENSITY - 1) >> BUCKET_DENSITY_BITS;
 
 	// Blocks
+	// Blocks are initialized when their page is first referenced
 	memory = new MemoryManager(layout->block_count * BLOCK_SIZE,
 		BLOCKS_PER_MEMORY_PAGE * BLOCK_SIZE,
 		THREAD_COUNT * MAX_BLOCKS_PER_REGION);
-
-	for (size_t i = 0; i < layout->block_count; i++)
-		initialize_block(i);
+	BlockInitializer initializer = { this };
+	memory->set_page_initializer(initializer);
 
 	// Shared data
-	block_owner = new char[layout->block_count];
+	block_owner = new OwnerType[layout->block_count];
+	block_epoch = new atomic<size_t>[layout->block_count];
+	block_resolved = new bool[layout->block_count];
 	block_location_index = new unsigned short[layout->block_count];
 	typename Layout::Coord block_coord;
 	for (size_t i = 0; i < layout->block_count; i++)
 	{
 		block_owner[i] = -1;
+		block_epoch[i] = 0;
+		block_resolved[i] = false;
 		layout->get_block_coord(i, block_coord);
 		block_location_index[i] = layout->get_block_location_index(block_coord);
 	}
 
-	gaps = new unsigned[layout->block_count];
+	size_t page_count = (layout->block_count + BLOCKS_PER_MEMORY_PAGE - 1) / BLOCKS_PER_MEMORY_PAGE;
+	page_resolved_count = new unsigned[page_count];
+	for (size_t p = 0; p < page_count; p++)
+		page_resolved_count[p] = 0;
+
+	// Stand-in neighbor for blocks that are released or were never referenced, its nodes are unreachable
+	resolved_block = new Block;
+	initialize_block(resolved_block, 0);
+	resolved_block->id = layout->block_count;
+	for (size_t j = 0; j < Layout::NODES_PER_BLOCK; j++)
+		resolved_block->nodes[j].distance = layout->node_count;
+
+	gaps = new size_t[layout->block_count];
 	for (size_t i = 0; i < layout->block_count; i++)
 		gaps[i] = layout->node_count;
 
 	active_count = new size_t[layout->block_count];
+	block_excess = new FlowType[layout->block_count];
+	block_label = new size_t[layout->block_count];
 	for (size_t i = 0; i < layout->block_count; i++)
+	{
 		active_count[i] = 0;
+		block_excess[i] = 0;
+		block_label[i] = 0;
+	}
 
 	label_counts = new size_t[bucket_count];
 	label_counts[0] = layout->node_count;
 	for (size_t b = 1; b < bucket_count; b++)
 		label_counts[b] = 0;
 
-	active = new DoublyLinkedArray<size_t>(layout->block_count);
+	// Active blocks are bucketed by priority, a single bucket is plain FIFO
+	size_t priority_count = 1;
+	if (BLOCK_SCHEDULING == HighestLabelScheduling)
+		priority_count = bucket_count;
+	else if (BLOCK_SCHEDULING == LargestExcessScheduling)
+		priority_count = sizeof(FlowType) * 8;
+	active = new DoublyLinkedArray<size_t>(layout->block_count, priority_count);
+	mailboxes = new vector<Mail>[layout->block_count];
+#ifdef USE_NARROW_RESIDUALS
+	overflow_spill = new map<unsigned, CapType>[layout->block_count];
+#endif
 
 	busy_count = THREAD_COUNT;
 	gap_count = 0;
@@ -64,40 +96,68 @@ RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::RegionPushRela
 	flow = 0;
 	work_done = false;
 	gap_found = false;
+#ifdef USE_ADAPTIVE_REGIONS
+	gap_relabel_count = 0;
+#endif
+	stream_threads = NULL;
+	loading = false;
+	complete_count = layout->block_count;
 
 	// Threads
-	for (char i = 0; i < THREAD_COUNT; i++)
+	for (int i = 0; i < THREAD_COUNT; i++)
 		workers[i] = new RegionWorker(this, i);
 }
 
-template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
-RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::~RegionPushRelabel()
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::~RegionPushRelabel()
 {
 	// Need to only call destructors, which nodes and blocks don't have
 	delete[] block_owner;
+	delete[] block_epoch;
+	delete[] block_resolved;
+	delete[] page_resolved_count;
+	delete resolved_block;
 	delete[] gaps;
 	delete[] label_counts;
 	delete[] active_count;
+	delete[] block_excess;
+	delete[] block_label;
 	delete active;
+	delete[] mailboxes;
+#ifdef USE_NARROW_RESIDUALS
+	delete[] overflow_spill;
+#endif
 
-	for (char i = 0; i < THREAD_COUNT; i++)
+	for (int i = 0; i < THREAD_COUNT; i++)
 		delete workers[i];
 
 	delete memory;
 }
 
-template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
-INLINE void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::initialize_block(size_t i)
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::initialize_page(char* page, MemoryManager::int64 addr, MemoryManager::int64 size)
 {
-	// Initialize block data, but don't populate its node list now (lazy load it instead)
-	Block* block = load_block(i);
+	// The last page can be partially used
+	size_t first = addr / BLOCK_SIZE;
+	size_t last = (addr + size) / BLOCK_SIZE;
+	if (last > layout->block_count)
+		last = layout->block_count;
+
+	for (size_t i = first; i < last; i++)
+		initialize_block((Block*)(page + (i - first) * BLOCK_SIZE), i);
+}
 
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+INLINE void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::initialize_block(Block* block, size_t i)
+{
+	// Initialize block data, but don't populate its node list now (lazy load it instead)
 	block->cur_node = 0;
 	block->cur_edge = 0;
 	block->region_id = 0;
 	block->list_populated = false;
 	block->id = i;
 	block->discharges = 0;
+	block->max_distance = 0;
 	block->active.clear();
 
 	Node* node = block->nodes;
@@ -115,29 +175,163 @@ INLINE void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::in
 		node->boundary = layout->get_boundary_membership(node_coord);
 		node->relabel = false;
 		node->location_index = layout->get_node_location_index(node_coord);
+#ifdef USE_NARROW_RESIDUALS
+		node->wide = 0;
+#endif
 
 		node++;
 	}
 
-	unload_block(i);
+#ifdef USE_NARROW_RESIDUALS
+	block->overflow_count = 0;
+	for (size_t k = 0; k < OVERFLOW_SLOTS; k++)
+		block->overflow[k].key = 0;
+#endif
 }
 
-template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
-INLINE void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::populated_active_list(Block* block)
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+INLINE void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::populated_active_list(Block* block)
 {
 	Node* node = block->nodes;
 	ActiveList& list = block->active;
 	for (size_t j = 0; j < Layout::NODES_PER_BLOCK; j++)
 	{
-		if (node->preflow > 0)
+		if (node->preflow > 0 && node->distance < layout->node_count)
 			list.push_back(j);
 		node++;
 	}
 	block->list_populated = true;
 }
 
-template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
-INLINE void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::add_edge(size_t node_i, size_t node_j, CapType cap, CapType rev_cap)
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+INLINE void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::apply_mailbox(Block* block, RegionWorker& worker)
+{
+	// Apply the flow sent to this block by other regions, in the same way discharge pushes it
+	vector<Mail>& mailbox = worker.inbox[block->region_id];
+	for (typename vector<Mail>::iterator mail = mailbox.begin(); mail != mailbox.end(); mail++)
+	{
+		Node* node = &block->nodes[mail->node_id];
+		add_residual(block, node, mail->sister, mail->delta);
+		node->preflow += mail->delta;
+
+		if (node->preflow <= 0)
+		{
+			worker.flow_to_sink += mail->delta;
+		}
+		else if (node->preflow <= mail->delta)
+		{
+			// Activated, an unpopulated list will pick the node up when populated
+			worker.flow_to_sink += mail->delta - node->preflow;
+			if (block->list_populated && node->distance < layout->node_count)
+				block->active.push_back(mail->node_id);
+		}
+	}
+	mailbox.clear();
+}
+
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::read_ghost_labels(RegionWorker& worker, unsigned region_index)
+{
+	// Labels only grow, and a node cannot be relabeled while its edge back to this region has residual, which only
+	// a region that reserved the node's block later can take away. So a label read now is safe to push against
+	// until the remote block is released and its epoch changes. The owners keep the remote blocks loaded meanwhile
+	Block* block = worker.region[region_index];
+	vector<IntegerPair>& remote = worker.remote_neighbors[region_index];
+	vector<size_t>& ghosts = worker.ghost_labels[region_index];
+	ghosts.resize(Layout::NODES_PER_BLOCK * Layout::NODE_EDGE_COUNT);
+
+	vector<Block*> remote_blocks(layout->block_edge_count, (Block*)NULL);
+	for (size_t be = 0; be < layout->block_edge_count; be++)
+		if (remote[be].first != layout->block_count)
+			remote_blocks[be] = load_block(remote[be].first);
+
+	Node* node = block->nodes;
+	for (size_t j = 0; j < Layout::NODES_PER_BLOCK; j++, node++)
+	{
+		if (node->boundary == 0)
+			continue;
+
+		ShiftType* offset = layout->get_node_shift_vector(node->cell_index, node->location_index);
+		SisterType* sister = layout->get_sister_edges(node->cell_index);
+		BlockEdgeType* block_edge = layout->get_block_edge(node->cell_index, node->location_index);
+		for (size_t e = 0; e < Layout::NODE_EDGE_COUNT; e++)
+		{
+			Block* remote_block = remote_blocks[block_edge[e]];
+			if (!(node->boundary & (1UL << e)) || remote_block == NULL)
+				continue;
+
+			Node& neighbor = remote_block->nodes[j + offset[e]];
+			if (sister[e] != -1 && neighbor.residual[sister[e]] > 0)
+				ghosts[j * Layout::NODE_EDGE_COUNT + e] = neighbor.distance;
+			else
+				ghosts[j * Layout::NODE_EDGE_COUNT + e] = layout->node_count;
+		}
+	}
+
+	for (size_t be = 0; be < layout->block_edge_count; be++)
+		if (remote_blocks[be] != NULL)
+			unload_block(remote[be].first);
+}
+
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+INLINE void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::update_block_summary(Block* block)
+{
+	if (BLOCK_SCHEDULING == FifoScheduling)
+		return;
+
+	// Total excess and highest label of the active nodes
+	FlowType excess = 0;
+	size_t label = 0;
+	ActiveList& list = block->active;
+	for (typename ActiveList::Iterator iter = list.begin(); iter != list.end(); iter++)
+	{
+		Node& node = block->nodes[list.get(iter)];
+		if (node.preflow > 0 && node.distance < layout->node_count)
+		{
+			excess += node.preflow;
+			if (node.distance > label)
+				label = node.distance;
+		}
+	}
+
+	block_excess[block->id] = excess;
+	block_label[block->id] = label;
+}
+
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+INLINE bool RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::is_block_resolved(Block* block)
+{
+	// Unreachable nodes can neither receive nor send flow again
+	Node* node = block->nodes;
+	for (size_t j = 0; j < Layout::NODES_PER_BLOCK; j++)
+	{
+		if (node->distance != layout->node_count)
+			return false;
+		node++;
+	}
+	return true;
+}
+
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+INLINE size_t RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::get_block_priority(size_t i)
+{
+	if (BLOCK_SCHEDULING == HighestLabelScheduling)
+		return block_label[i] >> BUCKET_DENSITY_BITS;
+
+	if (BLOCK_SCHEDULING == LargestExcessScheduling)
+	{
+		// Excess is bucketed by its order of magnitude
+		size_t priority = 0;
+		for (FlowType excess = block_excess[i]; excess > 1; excess /= 2)
+			priority++;
+		return priority;
+	}
+
+	return 0;
+}
+
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+INLINE void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::add_edge(size_t node_i, size_t node_j, CapType cap, CapType rev_cap)
 {
 	node_i = layout->get_node_id(node_i);
 	node_j = layout->get_node_id(node_j);
@@ -146,6 +340,11 @@ INLINE void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::ad
 	layout->get_node_block_index(node_i, block_i, node_subi);
 	layout->get_node_block_index(node_j, block_j, node_subj);
 
+	// The workers share the memory manager while a graph is streamed in
+	mutex::scoped_lock lock(active_mutex, boost::defer_lock);
+	if (loading)
+		lock.lock();
+
 	Block* block_from = load_block(block_i);
 	Block* block_to = load_block(block_j);
 
@@ -153,7 +352,7 @@ INLINE void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::ad
 	Node& node_to = block_to->nodes[node_subj];
 
 	ptrdiff_t shift = node_subj - node_subi;
-	ptrdiff_t* offset = layout->get_node_shift_vector(node_from.cell_index, node_from.location_index);
+	ShiftType* offset = layout->get_node_shift_vector(node_from.cell_index, node_from.location_index);
 	ptrdiff_t idx;
 	ptrdiff_t nedges = layout->get_edge_count(node_from.cell_index);
 
@@ -163,9 +362,12 @@ INLINE void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::ad
 
 	if (idx != nedges)
 	{
-		node_from.residual[idx] += cap;
-		idx = layout->get_sister_edges(node_from.cell_index)[idx];
-		if (idx != -1) node_to.residual[idx] += rev_cap;
+		ptrdiff_t sister = layout->get_sister_edges(node_from.cell_index)[idx];
+		FlowType value = (FlowType)get_residual(block_from, &node_from, idx) + cap;
+		FlowType rev_value = (sister != -1) ? (FlowType)get_residual(block_to, &node_to, sister) + rev_cap : 0;
+
+		store_residual(block_from, &node_from, idx, (CapType)value, value + rev_value);
+		if (sister != -1) store_residual(block_to, &node_to, sister, (CapType)rev_value, value + rev_value);
 	}
 	else
 	{
@@ -177,14 +379,23 @@ INLINE void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::ad
 	unload_block(block_j);
 }
 
-template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
-INLINE void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::add_terminal_weights(size_t node_id, FlowType src_cap, FlowType snk_cap)
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+INLINE void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::add_terminal_weights(size_t node_id, FlowType src_cap, FlowType snk_cap)
 {
 	node_id = layout->get_node_id(node_id);
 
 	size_t block_id, node_subid;
 	layout->get_node_block_index(node_id, block_id, node_subid);
 
+	// The workers share the memory manager and the flow while a graph is streamed in
+	mutex::scoped_lock lock(active_mutex, boost::defer_lock);
+	mutex::scoped_lock flow_lock(data_mutex, boost::defer_lock);
+	if (loading)
+	{
+		lock.lock();
+		flow_lock.lock();
+	}
+
 	Block* block = load_block(block_id);
 	Node& node = block->nodes[node_subid];
 
@@ -198,6 +409,8 @@ INLINE void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::ad
 	FlowType old_preflow = node.preflow;
 	node.preflow = src_cap - snk_cap;
 
+	block_excess[block_id] += (node.preflow > 0 ? node.preflow : 0) - (old_preflow > 0 ? old_preflow : 0);
+
 	if (old_preflow <= 0 && node.preflow > 0)
 		active_count[block_id]++;
 	else if (old_preflow > 0 && node.preflow <= 0)
@@ -206,18 +419,85 @@ INLINE void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::ad
 	unload_block(block_id);
 }
 
-template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
-void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::compute_maxflow()
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::start_maxflow()
 {
+	// Streaming construction: no block can be reserved until mark_loaded() says its data is complete
+	for (size_t i = 0; i < layout->block_count; i++)
+		block_owner[i] = BLOCK_LOADING;
+	complete_count = 0;
+	loading = true;
+
+	// All the workers run in the background while the caller keeps adding nodes and edges
+	stream_threads = new thread_group;
+	for (int i = 0; i < THREAD_COUNT; i++)
+	{
+		thread *t = new thread(&RegionWorker::work_loop, workers[i]);
+		stream_threads->add_thread(t);
+	}
+}
+
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::mark_loaded(size_t node_id)
+{
+	// All the nodes before node_id (and their edges) were added, hand over the blocks that became complete
+	size_t complete = layout->get_complete_block_count(node_id);
+
+	mutex::scoped_lock lock(active_mutex);
+	if (complete <= complete_count)
+		return;
+
+	for (size_t i = complete_count; i < complete; i++)
+	{
+		block_owner[i] = -1;
+		if (active_count[i] > 0)
+			active->push_back(i, get_block_priority(i));
+	}
+
+	// Wake up the workers that ran out of complete blocks
+	mutex::scoped_lock busy_lock(busy_mutex);
+	complete_count = complete;
+	work_cond.notify_all();
+}
+
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::compute_maxflow()
+{
+	// The graph was streamed in, complete the remaining blocks and wait for the workers
+	if (stream_threads != NULL)
+	{
+		mark_loaded(layout->node_count);
+		{
+			mutex::scoped_lock lock(busy_mutex);
+			loading = false;
+			work_cond.notify_all();
+		}
+
+		stream_threads->join_all();
+		delete stream_threads;
+		stream_threads = NULL;
+		return;
+	}
+
 	// Set up the active list
 	for (size_t i = 0; i < layout->block_count; i++)
 		if (active_count[i] > 0)
-			active->push_back(i);
+			active->push_back(i, get_block_priority(i));
+
+	solve();
+}
+
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::solve()
+{
+	// The workers can run again after a previous solve
+	busy_count = THREAD_COUNT;
+	work_done = false;
 
 	// Creates (THREAD_COUNT - 1) threads and joins in on the action
 	thread_group tgrp;
 
-	for (char i = 1; i < THREAD_COUNT; i++)
+	for (int i = 1; i < THREAD_COUNT; i++)
 	{
 		thread *t = new thread(&RegionWorker::work_loop, workers[i]);
 		tgrp.add_thread(t);
@@ -225,10 +505,127 @@ void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::compute_m
 
 	workers[0]->work_loop();
 	tgrp.join_all();
+
+	// The calling thread was bound to the node of the first worker
+	memory->run_on_node(-1);
+}
+
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::update_terminal_weights(size_t node_id, FlowType src_delta, FlowType snk_delta)
+{
+	node_id = layout->get_node_id(node_id);
+
+	size_t block_id, node_subid;
+	layout->get_node_block_index(node_id, block_id, node_subid);
+
+	// Released blocks only hold source side nodes with a saturated sink edge, which stay that way,
+	// so only the lost sink capacity counts
+	if (block_resolved[block_id])
+	{
+		flow += snk_delta;
+		return;
+	}
+
+	Block* block = load_block(block_id);
+	Node& node = block->nodes[node_subid];
+
+	// Same as add_terminal_weights, a negative sink delta takes flow back from the sink edge
+	FlowType src_cap = src_delta, snk_cap = snk_delta;
+	if (node.preflow > 0)
+		src_cap += node.preflow;
+	else
+		snk_cap -= node.preflow;
+
+	flow += (src_cap < snk_cap) ? src_cap : snk_cap;
+
+	FlowType old_preflow = node.preflow;
+	node.preflow = src_cap - snk_cap;
+
+	block_excess[block_id] += (node.preflow > 0 ? node.preflow : 0) - (old_preflow > 0 ? old_preflow : 0);
+
+	// A node that became active is picked up when its block's list is rebuilt
+	if (old_preflow <= 0 && node.preflow > 0 && node.distance < layout->node_count)
+	{
+		block->active.clear();
+		block->list_populated = false;
+		if (!active->contains(block_id))
+			active->push_back(block_id, get_block_priority(block_id));
+	}
+
+	unload_block(block_id);
+}
+
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+template <typename LambdaType, typename WeightFunction>
+void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::compute_parametric_maxflow(const vector<LambdaType>& lambdas, WeightFunction weights,
+	vector<FlowType>& flows, vector<size_t>& cuts)
+{
+	size_t count = layout->original_node_count;
+	flows.clear();
+	cuts.assign(count, lambdas.size());
+
+	// The capacities of the previous lambda are kept, so the weights are evaluated once per node and lambda
+	vector<FlowType> src_caps(count), snk_caps(count);
+	FlowType src_cap, snk_cap;
+	for (size_t k = 0; k < lambdas.size(); k++)
+	{
+		if (k == 0)
+		{
+			// Cold start for the first lambda
+			for (size_t i = 0; i < count; i++)
+			{
+				weights(i, lambdas[0], src_caps[i], snk_caps[i]);
+				add_terminal_weights(i, src_caps[i], snk_caps[i]);
+			}
+			compute_maxflow();
+		}
+		else
+		{
+			// Warm start: the capacity changes only grow the source side, so the labels stay valid
+			for (size_t i = 0; i < count; i++)
+			{
+				weights(i, lambdas[k], src_cap, snk_cap);
+				if (src_cap != src_caps[i] || snk_cap != snk_caps[i])
+				{
+					update_terminal_weights(i, src_cap - src_caps[i], snk_cap - snk_caps[i]);
+					src_caps[i] = src_cap;
+					snk_caps[i] = snk_cap;
+				}
+			}
+			solve();
+		}
+
+		// Cuts are nested, so only the nodes still on the sink side need to be checked
+		flows.push_back(flow);
+		for (size_t i = 0; i < count; i++)
+			if (cuts[i] == lambdas.size() && get_segment(i) == 0)
+				cuts[i] = k;
+	}
 }
 
-template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
-void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::update_region_sync(RegionWorker& worker)
+#ifdef USE_TRACE
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::dump_trace(const string& filename)
+{
+	// One trace thread per worker, and one more for the paging done by the memory manager
+	ofstream out(filename.c_str());
+	out << "{\"traceEvents\":[\n";
+
+	bool first = true;
+	for (int i = 0; i < THREAD_COUNT; i++)
+	{
+		stringstream name;
+		name << "worker " << i;
+		workers[i]->trace.write(out, 0, i, name.str(), first);
+	}
+	memory->get_trace().write(out, 0, THREAD_COUNT, "memory", first);
+
+	out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+}
+#endif
+
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::update_region_sync(RegionWorker& worker)
 {
 	mutex::scoped_lock lock(active_mutex);
 
@@ -237,44 +634,90 @@ void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::update_re
 	for (unsigned i = 0; i < worker.region_size; i++)
 	{
 		block = worker.region[i];
+#ifdef USE_TRACE
+		worker.trace.instant("release", "block", block->id);
+#endif
 
 		block_owner[block->id] = -1;
-		if (block->is_active())
-			active->push_back(block->id);
+		update_block_summary(block);
+		if (block->is_active() || !mailboxes[block->id].empty())
+			active->push_back(block->id, get_block_priority(block->id));
+		else if (is_block_resolved(block))
+			block_resolved[block->id] = true;
 
 		unload_block(block->id);
+
+		// Drop the page once all of its blocks are resolved
+		if (block_resolved[block->id])
+		{
+			size_t p = block->id / BLOCKS_PER_MEMORY_PAGE;
+			size_t page_blocks = min((size_t)BLOCKS_PER_MEMORY_PAGE, layout->block_count - p * BLOCKS_PER_MEMORY_PAGE);
+			if (++page_resolved_count[p] == page_blocks)
+				memory->discard(p * BLOCKS_PER_MEMORY_PAGE * BLOCK_SIZE);
+		}
+
+		for (size_t e = 0; e < layout->block_edge_count; e++)
+			worker.remote_neighbors[i][e].first = layout->block_count;
 	}
 
 	worker.region_size = 0;
 
-	// Reserve the next active block to start a region
+	// Post the flow sent over the region borders, blocks that are not owned become active
+	// Flow sent to a node that became unreachable in the meantime is dropped with its block
+	for (typename vector<Mail>::iterator mail = worker.outbox.begin(); mail != worker.outbox.end(); mail++)
+	{
+		if (block_resolved[mail->block_id])
+			continue;
+
+		mailboxes[mail->block_id].push_back(*mail);
+		block_excess[mail->block_id] += mail->delta;
+		if (block_owner[mail->block_id] == -1 && !active->contains(mail->block_id))
+			active->push_back(mail->block_id, get_block_priority(mail->block_id));
+	}
+	worker.outbox.clear();
+	worker.seen_complete = complete_count;
+
+	// Reserve the next active block to start a region, in order of priority
 	// Make sure that this block is not neighboring any other reserved block to avoid "livelock" situations
-	size_t block_id;
+	// Prefer a block homed on the NUMA node of this worker, otherwise settle for the first one found
+	size_t block_id, remote_id = layout->block_count;
 
-	unsigned active_index, active_max = active->get_count();
-	for (active_index = 0; active_index < active_max; active_index++)
+	for (block_id = active->front(); block_id != active->end(); block_id = active->next(block_id))
 	{
-		block_id = active->pop_front();
-
 		unsigned e;
 		for (e = 0; e < layout->block_edge_count; e++)
 		{
-			if (block_owner[block_id + layout->get_block_shift_vector(block_location_index[block_id])[e]] != -1)
+			OwnerType owner = block_owner[block_id + layout->get_block_shift_vector(block_location_index[block_id])[e]];
+			if (owner != -1 && owner != BLOCK_LOADING)
 				break;
 		}
 		if (e == layout->block_edge_count)
-			break;
-		
-		active->push_back(block_id);
+		{
+			if (memory->get_page_node(block_id * BLOCK_SIZE) == worker.node)
+				break;
+			if (remote_id == layout->block_count)
+				remote_id = block_id;
+		}
 	}
 
-	// No block matches the criteria, this thread can now sleep
-	if (active_index == active_max)
-		return;
+	if (block_id == active->end())
+	{
+		// No block matches the criteria, this thread can now sleep
+		if (remote_id == layout->block_count)
+			return;
 
-	// Start reserving the neighbors of that first block
+		block_id = remote_id;
+	}
+	active->remove(block_id);
+
+	// Start reserving the neighbors of that first block, its mail is applied once the lock is released
 	block = load_block(block_id);
 	block_owner[block_id] = worker.thread_id;
+	block_epoch[block_id].fetch_add(1, memory_order_release);
+	worker.inbox[0].swap(mailboxes[block_id]);
+#ifdef USE_TRACE
+	worker.trace.instant("reserve", "block", block_id);
+#endif
 
 	if (!block->list_populated)
 		populated_active_list(block);
@@ -286,6 +729,7 @@ void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::update_re
 
 	// Reserve the block neighbors to create a region that is not overlapping with any reserved blocks
 	size_t block_mask = 0;
+	size_t remote_mask = 0;
 	size_t edge_count = 0;
 	size_t region_index = 0;
 	Block* cur_block = worker.region[0];
@@ -297,18 +741,30 @@ void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::update_re
 			// Calculate the new block id using the absolute offset lookup table
 			block_id = cur_block->id + layout->get_block_shift_vector(block_location_index[cur_block->id])[cur_block->cur_edge];
 
+			// Blocks that are released or were never referenced cannot take part in the solve,
+			// link to the stand-in block so that their nodes are seen as unreachable
+			if (block_resolved[block_id] || !memory->is_touched(block_id * BLOCK_SIZE))
+			{
+				worker.neighbors[region_index][cur_block->cur_edge] = resolved_block;
+				block_mask |= ((size_t)1 << cur_block->cur_edge);
+			}
 			// If we don't have enough blocks and this block is not owned by another thread, grab it
-			if (worker.region_size < MAX_BLOCKS_PER_REGION &&
+			else if (worker.region_size < worker.region_limit &&
 				block_owner[block_id] == -1)
 			{
 				block = load_block(block_id);
 				block_owner[block->id] = worker.thread_id;
+				block_epoch[block_id].fetch_add(1, memory_order_release);
+				worker.inbox[worker.region_size].swap(mailboxes[block_id]);
+#ifdef USE_TRACE
+				worker.trace.instant("reserve", "block", block_id);
+#endif
 
 				if (!block->list_populated)
 					populated_active_list(block);
 				block->cur_node = block->active.begin();
 
-				if (block->is_active())
+				if (active->contains(block_id))
 					active->remove(block_id);
 
 				worker.region[worker.region_size] = block;
@@ -317,18 +773,32 @@ void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::update_re
 
 				// Set the neighbor link and build a mask for which edges we have seen
 				worker.neighbors[region_index][cur_block->cur_edge] = block;
-				block_mask |= (1 << (size_t)cur_block->cur_edge);
+				block_mask |= ((size_t)1 << cur_block->cur_edge);
 			}
 			// If this block is already this thread's, just set the neighbor link
 			else if (block_owner[block_id] == worker.thread_id)
 			{
-				block = load_block(block_id);
+				// The block is already referenced by this region, so don't reference its page again
+				for (unsigned i = 0; i < worker.region_size; i++)
+				{
+					block = worker.region[i];
+					if (block->id == block_id)
+						break;
+				}
 				worker.neighbors[region_index][cur_block->cur_edge] = block;
-				block_mask |= (1 << (size_t)cur_block->cur_edge);
+				block_mask |= ((size_t)1 << cur_block->cur_edge);
 			}
 			else
-			// Otherwise, leave that one because it is already being processed
+			{
+				// Otherwise, leave that one because it is already being processed, but keep its id and epoch
+				// to send flow to it
 				worker.neighbors[region_index][cur_block->cur_edge] = NULL;
+				if (block_owner[block_id] != -1 && block_owner[block_id] != BLOCK_LOADING)
+				{
+					worker.remote_neighbors[region_index][cur_block->cur_edge] = IntegerPair(block_id, block_epoch[block_id].load(memory_order_relaxed));
+					remote_mask |= ((size_t)1 << cur_block->cur_edge);
+				}
+			}
 
 			edge_count++;
 			cur_block->cur_edge++;
@@ -347,12 +817,21 @@ void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::update_re
 					worker.boundary_mask[region_index][c][l] = 0;
 					for (size_t be = 0; be < layout->block_edge_count; be++)
 					{
-						if (block_mask & (1 << be))
+						if (block_mask & ((size_t)1 << be))
 							worker.boundary_mask[region_index][c][l] |= node_mask[be];
 					}
 				}
 			}
 
+			if (remote_mask != 0)
+				read_ghost_labels(worker, region_index);
+
+			// Start from the next block edge the next time this block is reserved, so that
+			// a region that cannot hold all of the neighbors does not always grab the same ones
+			cur_block->cur_edge++;
+			if (cur_block->cur_edge == layout->block_edge_count)
+				cur_block->cur_edge = 0;
+
 			// Move to next block
 			region_index++;
 			if (region_index == worker.region_size)
@@ -361,6 +840,7 @@ void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::update_re
 			cur_block = worker.region[region_index];
 			edge_count = 0;
 			block_mask = 0;
+			remote_mask = 0;
 		}
 	}
 
@@ -369,8 +849,8 @@ void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::update_re
 		work_cond.notify_all();
 }
 
-template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
-void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::update_data_sync(RegionWorker& worker)
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::update_data_sync(RegionWorker& worker)
 {
 	mutex::scoped_lock lock(data_mutex);
 
@@ -402,10 +882,13 @@ void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::update_da
 	while (current < worker.relabels_iter)
 	{
 		bucket = current->first >> BUCKET_DENSITY_BITS;
-		label_counts[bucket]--;
+		if (bucket < bucket_count)
+		{
+			label_counts[bucket]--;
 
-		if (label_counts[bucket] == 0)
-			possible_gaps.push_back(bucket);
+			if (label_counts[bucket] == 0)
+				possible_gaps.push_back(bucket);
+		}
 
 		current++;
 	}
@@ -417,8 +900,8 @@ void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::update_da
 		gap_found = true;
 }
 
-template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
-void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::wait_for_gap_relabeling()
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::wait_for_gap_relabeling()
 {
 	// All threads collapse here, and the last thread up does gap relabeling
 	mutex::scoped_lock lock(busy_mutex);
@@ -440,8 +923,8 @@ void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::wait_for_
 	}
 }
 
-template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
-void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::wait_for_work()
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::wait_for_work(RegionWorker& worker)
 {
 	// All threads collapse here, and wait until more work is available, or all work is done
 	mutex::scoped_lock lock(busy_mutex);
@@ -450,7 +933,13 @@ void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::wait_for_
 	if (busy_count > 1 || (!gap_found && gap_count > 0))
 	{
 		busy_count--;
+#ifdef USE_TRACE
+		TraceBuffer::int64 start = TraceBuffer::now();
 		work_cond.wait(lock);
+		worker.trace.span("wait_for_work", start);
+#else
+		work_cond.wait(lock);
+#endif
 
 		if (!work_done)
 			busy_count++;
@@ -464,6 +953,25 @@ void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::wait_for_
 		lock.unlock();
 		gap_cond.notify_all();
 	}
+	// While a graph is streamed in, sleep until more blocks are complete,
+	// unless some were completed since this thread last looked for work
+	else if (loading)
+	{
+		if (worker.seen_complete == complete_count)
+		{
+			busy_count--;
+#ifdef USE_TRACE
+			TraceBuffer::int64 start = TraceBuffer::now();
+			work_cond.wait(lock);
+			worker.trace.span("wait_for_loading", start);
+#else
+			work_cond.wait(lock);
+#endif
+
+			if (!work_done)
+				busy_count++;
+		}
+	}
 	// If all work is done, wake up all threads so they would finish
 	else
 	{
@@ -476,8 +984,8 @@ void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::wait_for_
 	}
 }
 
-template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
-void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::update_block_gaps()
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::update_block_gaps()
 {
 	// Find the minimum gap
 	size_t minimum_gap = bucket_count;
@@ -505,6 +1013,9 @@ void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::update_bl
 			label_counts[distance] = 0;
 
 		max_bucket = minimum_gap - 1;
+#ifdef USE_ADAPTIVE_REGIONS
+		gap_relabel_count++;
+#endif
 	}
 
 	// Reset gap variables
@@ -516,8 +1027,8 @@ void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::update_bl
 // RegionWorker
 //////////////////////
 
-template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
-RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::RegionWorker::RegionWorker(RegionPushRelabel* g, char id)
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::RegionWorker::RegionWorker(RegionPushRelabel* g, OwnerType id)
 {
 	flow_to_sink = 0;
 	relabels_list = new IntegerPair[MAX_RELABELS_PER_BLOCK * MAX_BLOCKS_PER_REGION];
@@ -525,25 +1036,38 @@ RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::RegionWorker::
 	thread_id = id;
 	graph = g;
 	region_size = 0;
+	region_limit = MAX_BLOCKS_PER_REGION;
+	discharge_budget = DISCHARGES_PER_BLOCK;
+	seen_complete = 0;
+	augment_pending = false;
+
+	// Workers are split evenly between the NUMA nodes
+	node = (int)id * graph->memory->get_node_count() / THREAD_COUNT;
 
 	// Neighbors initial size
 	for (size_t i = 0; i < MAX_BLOCKS_PER_REGION; i++)
+	{
 		neighbors[i].resize(graph->layout->block_edge_count);
+		remote_neighbors[i].resize(graph->layout->block_edge_count, IntegerPair(graph->layout->block_count, 0));
+	}
 
 	// Boundary mask initial size
 	for (unsigned i = 0; i < MAX_BLOCKS_PER_REGION; i++)
 		for (unsigned c = 0; c < Layout::NODES_PER_CELL; c++)
 			boundary_mask[i][c].resize(graph->layout->location_counts[c]);
+
+	if (REGION_SOLVER == AugmentingPathSolver)
+		search_edge.resize(MAX_BLOCKS_PER_REGION * Layout::NODES_PER_BLOCK);
 }
 
-template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
-RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::RegionWorker::~RegionWorker()
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::RegionWorker::~RegionWorker()
 {
 	delete[] relabels_list;
 }
 
-template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
-INLINE void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::RegionWorker::find_next_relabel_distance(size_t& distance, deque<Node*>* bucket, priority_queue<Node*, deque<Node*>, NodeCompare>* fixed)
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+INLINE void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::RegionWorker::find_next_relabel_distance(size_t& distance, deque<Node*>* bucket, priority_queue<Node*, deque<Node*>, NodeCompare>* fixed)
 {
 	// Find the next distance to track by peeking into the bucket
 	size_t d = graph->layout->node_count;
@@ -593,8 +1117,8 @@ INLINE void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::Re
 	}
 }
 
-template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
-void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::RegionWorker::relabel_region()
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::RegionWorker::relabel_region()
 {
 	// We will use two bucket lists to do BFS on the nodes of the blocks, two buckets per block
 	// We also need three bucket pointers to do the work
@@ -631,9 +1155,9 @@ void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::RegionWor
 	Node *neighbor;
 	Block *neighbor_block;
 	Block **all_neighbors;
-	ptrdiff_t *sister;
-	ptrdiff_t *offset;
-	ptrdiff_t* block_edge;
+	SisterType *sister;
+	ShiftType *offset;
+	BlockEdgeType* block_edge;
 	ptrdiff_t nedges;
 	unsigned node_id, neighbor_id;
 	bool done;
@@ -669,7 +1193,7 @@ void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::RegionWor
 				{
 					neighbor_id = node_id + *offset;
 
-					if (node->boundary & (1 << e))
+					if (node->boundary & (1UL << e))
 					{
 						neighbor_block = all_neighbors[*block_edge];
 						if (neighbor_block == NULL)
@@ -720,7 +1244,13 @@ void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::RegionWor
 	{
 		block = region[i];
 
-		// Make their distance unreachable in the nodes array
+		// Fixed nodes that are already unreachable are never collected, drop them before the region changes
+		while (!fixed[i].empty())
+			fixed[i].pop();
+		bucket_from[i].clear();
+
+		// Make their distance unreachable in the nodes array, and find the highest label left
+		block->max_distance = 0;
 		node = block->nodes;
 		for (size_t j = 0; j < Layout::NODES_PER_BLOCK; j++)
 		{
@@ -733,6 +1263,8 @@ void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::RegionWor
 				node->distance = graph->layout->node_count;
 				node->relabel = false;
 			}
+			else if (node->distance > block->max_distance && node->distance != graph->layout->node_count)
+				block->max_distance = node->distance;
 			node++;
 		}
 
@@ -748,8 +1280,8 @@ void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::RegionWor
 	}
 }
 
-template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
-INLINE bool RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::RegionWorker::relabel(Node* node)
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+INLINE bool RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::RegionWorker::relabel(Node* node)
 {
 	Node* neighbor;
 	Block *neighbor_block;
@@ -757,9 +1289,9 @@ INLINE bool RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::Re
 	size_t min_label = graph->layout->node_count - 1;
 	size_t min_edge = 0;
 
-	ptrdiff_t *offset = graph->layout->get_node_shift_vector(node->cell_index, node->location_index);
-	CapType *residual = node->residual;
-	ptrdiff_t *block_edge = graph->layout->get_block_edge(node->cell_index, node->location_index);
+	ShiftType *offset = graph->layout->get_node_shift_vector(node->cell_index, node->location_index);
+	ResidualType *residual = node->residual;
+	BlockEdgeType *block_edge = graph->layout->get_block_edge(node->cell_index, node->location_index);
 
 	// Since we're checking for residual before anything, we can use the faster Layout::NODE_EDGE_COUNT
 	for (size_t e = 0; e < Layout::NODE_EDGE_COUNT; e++)
@@ -767,7 +1299,7 @@ INLINE bool RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::Re
 		if (*residual > 0)
 		{
 			// A boundary node with a neighbor that we do not have the right to process? don't relabel!
-			if (node->boundary & (1 << e))
+			if (node->boundary & (1UL << e))
 			{
 				neighbor_block = cur_neighbors[*block_edge];
 				if (neighbor_block == NULL)
@@ -790,26 +1322,29 @@ INLINE bool RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::Re
 
 	node->cur_edge = min_edge;
 	node->distance = min_label + 1;
+	if (node->distance > cur_block->max_distance && node->distance < graph->layout->node_count)
+		cur_block->max_distance = node->distance;
 	return true;
 }
 
-template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
-void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::RegionWorker::discharge()
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::RegionWorker::discharge()
 {
 	IntegerPair*& r = relabels_iter;
 	ActiveList& list = cur_block->active;
 
 	Node *node, *neighbor;
-	CapType* residual;
+	ResidualType* residual;
+	CapType cap;
 	FlowType delta;
-	ptrdiff_t* offset;
-	ptrdiff_t* sister;
-	ptrdiff_t* block_edge;
+	ShiftType* offset;
+	SisterType* sister;
+	BlockEdgeType* block_edge;
 	size_t old_distance;
 	Block* neighbor_block;
 	unsigned node_id, neighbor_id;
 
-	int count = DISCHARGES_PER_BLOCK;
+	int count = (int)discharge_budget;
 	bool can_relabel;
 
 	// For all nodes
@@ -821,6 +1356,9 @@ void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::RegionWor
 		node_id = list.get(cur_block->cur_node);
 		node = &cur_block->nodes[node_id];
 		can_relabel = true;
+#ifdef USE_ADAPTIVE_REGIONS
+		visit_count++;
+#endif
 
 		// Push to neighbors
 		old_distance = node->distance;
@@ -852,6 +1390,9 @@ void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::RegionWor
 				else
 				{
 					// Node is stuck
+#ifdef USE_ADAPTIVE_REGIONS
+					stuck_count++;
+#endif
 					cur_block->cur_node++;
 					break;
 				}
@@ -862,11 +1403,45 @@ void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::RegionWor
 			{
 				neighbor_id = node_id + *offset;
 
-				if (node->boundary & (1 << (size_t)node->cur_edge))
+				if (node->boundary & (1UL << node->cur_edge))
 				{
 					neighbor_block = cur_neighbors[*block_edge];
 					if (neighbor_block == NULL)
 					{
+						// The neighbor belongs to another region, push against the label read when this region was
+						// reserved while that region holds the block, and send the flow by mail. The epoch is read
+						// without the lock, the acquire load pairs with the release bump of the next reservation
+						IntegerPair& remote = cur_remote[*block_edge];
+						if (remote.first != graph->layout->block_count &&
+							graph->block_epoch[remote.first].load(memory_order_acquire) == remote.second &&
+							node->distance == cur_ghosts[node_id * Layout::NODE_EDGE_COUNT + node->cur_edge] + 1)
+						{
+							cap = graph->get_residual(cur_block, node, node->cur_edge);
+							if (node->preflow < cap)
+							{
+								delta = node->preflow;
+								list.remove(cur_block->cur_node);
+							}
+							else
+							{
+								delta = cap;
+							}
+
+							graph->add_residual(cur_block, node, node->cur_edge, -delta);
+							node->preflow -= delta;
+
+							Mail mail = { remote.first, neighbor_id, *sister, (CapType)delta };
+							outbox.push_back(mail);
+
+							// Deactivated
+							if (node->preflow == 0)
+								break;
+
+							node->cur_edge++;
+							offset++; residual++; sister++; block_edge++;
+							continue;
+						}
+
 						// Skip edge, node cannot be relabeled
 						can_relabel = false;
 
@@ -884,18 +1459,19 @@ void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::RegionWor
 
 				if (node->distance == neighbor->distance + 1)
 				{
-					if (node->preflow < *residual)
+					cap = graph->get_residual(cur_block, node, node->cur_edge);
+					if (node->preflow < cap)
 					{
 						delta = node->preflow;
 						list.remove(cur_block->cur_node);
 					}
 					else
 					{
-						delta = *residual;
+						delta = cap;
 					}
 
-					*residual -= delta;
-					if (*sister != -1) neighbor->residual[*sister] += delta;
+					graph->add_residual(cur_block, node, node->cur_edge, -delta);
+					if (*sister != -1) graph->add_residual(neighbor_block, neighbor, *sister, delta);
 					node->preflow -= delta;
 					neighbor->preflow += delta;
 
@@ -932,8 +1508,8 @@ void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::RegionWor
 	}
 }
 
-template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
-void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::RegionWorker::gap_relabel()
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::RegionWorker::gap_relabel()
 {
 	region_discharges = 0;
 	Block* block;
@@ -949,41 +1525,61 @@ void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::RegionWor
 		if (gap_distance == graph->layout->node_count)
 			continue;
 
-		// Clean up the active list
-		ActiveList& list = block->active;
-		for (iter = block->cur_node; iter != list.end();)
+		// Blocks with no node above the gap have nothing to remove
+		if (block->max_distance > gap_distance)
 		{
-			node = &block->nodes[list.get(iter)];
-			if (node->distance > gap_distance)
+			// Clean up the active list
+			ActiveList& list = block->active;
+			for (iter = block->cur_node; iter != list.end();)
 			{
-				node->distance = graph->layout->node_count;
-				list.remove(iter);
+				node = &block->nodes[list.get(iter)];
+				if (node->distance > gap_distance)
+				{
+					node->distance = graph->layout->node_count;
+					list.remove(iter);
+				}
+				else
+					iter++;
 			}
-			else
-				iter++;
-		}
 
-		// Loop through the rest of the nodes
-		node = block->nodes;
-		for (size_t j = 0; j < Layout::NODES_PER_BLOCK; j++)
-		{
-			if (node->distance != graph->layout->node_count && node->distance > gap_distance)
-				node->distance = graph->layout->node_count;
-			node++;
+			// Loop through the rest of the nodes, and find the highest label left
+			block->max_distance = 0;
+			node = block->nodes;
+			for (size_t j = 0; j < Layout::NODES_PER_BLOCK; j++)
+			{
+				if (node->distance != graph->layout->node_count)
+				{
+					if (node->distance > gap_distance)
+						node->distance = graph->layout->node_count;
+					else if (node->distance > block->max_distance)
+						block->max_distance = node->distance;
+				}
+				node++;
+			}
 		}
 
 		graph->gaps[block->id] = graph->layout->node_count;
 	}
 }
 
-template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
-void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::RegionWorker::discharge_region()
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::RegionWorker::discharge_region()
 {
+	// The augmenting path solver sends the excess that can reach a sink node of a new region there first,
+	// and leaves the rest to the discharges
+	if (REGION_SOLVER == AugmentingPathSolver && augment_pending)
+	{
+		augment_pending = false;
+		augment_region();
+	}
+
 	// Discharge blocks iteratively, break if a gap is found
 	for (unsigned cur_index = 0; cur_index < region_size; cur_index++)
 	{
 		cur_block = region[cur_index];
 		cur_neighbors = &neighbors[cur_index][0];
+		cur_remote = &remote_neighbors[cur_index][0];
+		cur_ghosts = ghost_labels[cur_index].empty() ? NULL : &ghost_labels[cur_index][0];
 
 		if (graph->gap_found)
 			return;
@@ -992,8 +1588,145 @@ void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::RegionWor
 	}
 }
 
-template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
-bool RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::RegionWorker::is_region_discharged()
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::RegionWorker::augment_region()
+{
+	// Alternate exact labels for the region with a blocking flow along its admissible edges, until no active node
+	// has a path to a sink node of the region left. Boundary nodes keep their labels as fixed terminals, as in
+	// relabel_region, and every phase lengthens the shortest path left, so the phases are few
+	while (true)
+	{
+		relabel_region();
+		graph->update_data_sync(*this);
+		if (graph->gap_found || !augment_paths())
+			return;
+	}
+}
+
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+bool RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::RegionWorker::augment_paths()
+{
+	// Every edge is searched at most once per phase
+	for (unsigned i = 0; i < region_size; i++)
+		memset(&search_edge[i * Layout::NODES_PER_BLOCK], 0, Layout::NODES_PER_BLOCK);
+
+	bool augmented = false;
+	Block* block;
+	Node *source, *sink;
+	CapType cap;
+	FlowType delta;
+
+	for (unsigned i = 0; i < region_size; i++)
+	{
+		block = region[i];
+		ActiveList& list = block->active;
+		for (typename ActiveList::Iterator iter = block->cur_node; iter != list.end();)
+		{
+			source = &block->nodes[list.get(iter)];
+			while (source->preflow > 0 && find_path(block, source))
+			{
+				// The bottleneck is the smallest of the excess, the residuals on the path and the sink capacity
+				sink = path.back().next_node;
+				delta = source->preflow;
+				if (-sink->preflow < delta)
+					delta = -sink->preflow;
+				for (typename vector<PathStep>::iterator step = path.begin(); step != path.end(); step++)
+				{
+					cap = graph->get_residual(step->block, step->node, step->edge);
+					if (cap < delta)
+						delta = cap;
+				}
+
+				for (typename vector<PathStep>::iterator step = path.begin(); step != path.end(); step++)
+				{
+					graph->add_residual(step->block, step->node, step->edge, -delta);
+					if (step->sister != -1) graph->add_residual(step->next_block, step->next_node, step->sister, delta);
+				}
+				source->preflow -= delta;
+				sink->preflow += delta;
+				flow_to_sink += delta;
+				augmented = true;
+			}
+
+			// Deactivated, the last node of the list takes its place
+			if (source->preflow == 0)
+				list.remove(iter);
+			else
+				iter++;
+		}
+	}
+
+	return augmented;
+}
+
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+bool RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::RegionWorker::find_path(Block* block, Node* source)
+{
+	// Depth-first search from the source to a sink node along admissible edges in the region, the label drops
+	// by one on every edge so the path never loops. A node with all of its edges searched is a dead end
+	Node *node = source, *neighbor = NULL;
+	Block* neighbor_block = NULL;
+	ShiftType* offset;
+	SisterType* sister;
+	BlockEdgeType* block_edge;
+	ptrdiff_t nedges;
+	unsigned node_id;
+
+	path.clear();
+	while (node->preflow >= 0)
+	{
+		node_id = node - block->nodes;
+		unsigned char& e = search_edge[block->region_id * Layout::NODES_PER_BLOCK + node_id];
+		offset = graph->layout->get_node_shift_vector(node->cell_index, node->location_index);
+		sister = graph->layout->get_sister_edges(node->cell_index);
+		block_edge = graph->layout->get_block_edge(node->cell_index, node->location_index);
+		nedges = graph->layout->get_edge_count(node->cell_index);
+
+		for (; e < nedges; e++)
+		{
+			if (node->residual[e] == 0)
+				continue;
+
+			// Blocks outside of the region are never entered
+			if (node->boundary & (1UL << e))
+			{
+				neighbor_block = neighbors[block->region_id][block_edge[e]];
+				if (neighbor_block == NULL)
+					continue;
+			}
+			else
+				neighbor_block = block;
+
+			neighbor = &neighbor_block->nodes[node_id + offset[e]];
+			if (node->distance == neighbor->distance + 1)
+				break;
+		}
+
+		if (e < nedges)
+		{
+			PathStep step = { block, node, e, sister[e], neighbor_block, neighbor };
+			path.push_back(step);
+			block = neighbor_block;
+			node = neighbor;
+		}
+		else
+		{
+			// Go back and move past the edge that led to the dead end
+			if (path.empty())
+				return false;
+
+			block = path.back().block;
+			node = path.back().node;
+			path.pop_back();
+			search_edge[block->region_id * Layout::NODES_PER_BLOCK + (node - block->nodes)]++;
+		}
+	}
+
+	return true;
+}
+
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+bool RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::RegionWorker::is_region_discharged()
 {
 	// If all node pointers are at the end, we finished discharging this region
 	Block* block;
@@ -1006,21 +1739,46 @@ bool RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::RegionWor
 	return true;
 }
 
-template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6>
-void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::RegionWorker::work_loop()
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::RegionWorker::work_loop()
 {
+	graph->memory->run_on_node(node);
+
+#ifdef USE_ADAPTIVE_REGIONS
+	// Every solve starts with long discharges over whole regions
+	region_limit = MAX_BLOCKS_PER_REGION;
+	discharge_budget = DISCHARGES_PER_BLOCK;
+	visit_count = stuck_count = 0;
+	seen_gap_relabels = graph->gap_relabel_count;
+#endif
+
 	while (true)
 	{
 		// Reserve a new region if needed
 		if (is_region_discharged())
 		{
+#ifdef USE_TRACE
+			TraceBuffer::int64 start = TraceBuffer::now();
+			relabel_region();
+			trace.span("relabel_region", start, "blocks", region_size);
+#else
 			relabel_region();
+#endif
+			graph->update_data_sync(*this);
+#ifdef USE_ADAPTIVE_REGIONS
+			adapt_region();
+#endif
 			graph->update_region_sync(*this);
+			augment_pending = true;
+
+			// The mail was taken from the mailboxes while reserving, so it is applied without the lock
+			for (unsigned i = 0; i < region_size; i++)
+				graph->apply_mailbox(region[i], *this);
 
 			// Wait for more work if region is empty
 			if (region_size == 0)
 			{
-				graph->wait_for_work();
+				graph->wait_for_work(*this);
 				if (graph->work_done)
 					break;
 				else
@@ -1030,14 +1788,73 @@ void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6>::RegionWor
 
 		// Wait for synchronization if gap is found
 		if (graph->gap_found)
+		{
+#ifdef USE_TRACE
+			TraceBuffer::int64 start = TraceBuffer::now();
+			graph->wait_for_gap_relabeling();
+			trace.span("gap_barrier", start);
+#else
 			graph->wait_for_gap_relabeling();
+#endif
+		}
 
 		// Process the new region and update shared data
 		gap_relabel();
 
+#ifdef USE_TRACE
+		TraceBuffer::int64 start = TraceBuffer::now();
+		discharge_region();
+		trace.span("discharge_region", start, "blocks", region_size);
+#else
 		discharge_region();
+#endif
 		graph->update_data_sync(*this);
+#ifdef USE_ADAPTIVE_REGIONS
+		adapt_discharge_budget();
+#endif
 	}
 }
 
+#ifdef USE_ADAPTIVE_REGIONS
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::RegionWorker::adapt_region()
+{
+	// Nodes stuck on the region boundary need more of their neighbors in the region, and a node is only relabeled
+	// once all of them are, so stuck nodes always grow the region back towards MAX_BLOCKS_PER_REGION
+	// Otherwise, threads waiting for work get a share of the active blocks sooner from smaller regions
+	// The counts are read without the lock, a stale value only delays the adjustment
+	int idle_count = THREAD_COUNT - graph->busy_count - graph->gap_count;
+	if (stuck_count * STUCK_SHARE > visit_count)
+	{
+		if (region_limit < MAX_BLOCKS_PER_REGION)
+			region_limit++;
+	}
+	else if (idle_count > 0 && region_limit > 1)
+		region_limit--;
+
+	visit_count = stuck_count = 0;
+}
+
+template <typename CapType, typename FlowType, typename A0, typename A1, typename A2, typename A3, typename A4, typename A5, typename A6, typename A7, typename A8>
+void RegionPushRelabel<CapType, FlowType, A0, A1, A2, A3, A4, A5, A6, A7, A8>::RegionWorker::adapt_discharge_budget()
+{
+	// Gaps are only found when the relabels are posted after a pass, so shorten the passes while gaps
+	// keep turning up, and let them grow back by a quarter per pass otherwise
+	if (graph->gap_found || graph->gap_relabel_count != seen_gap_relabels)
+	{
+		discharge_budget /= 2;
+		if (discharge_budget < MIN_DISCHARGES_PER_BLOCK)
+			discharge_budget = MIN_DISCHARGES_PER_BLOCK;
+	}
+	else
+	{
+		discharge_budget += discharge_budget / 4 + 1;
+		if (discharge_budget > DISCHARGES_PER_BLOCK)
+			discharge_budget = DISCHARGES_PER_BLOCK;
+	}
+
+	seen_gap_relabels = graph->gap_relabel_count;
+}
+#endif
+
 #endif
@@ -0,0 +1,115 @@
+/////////////////////////////////////////////////////////////////////////////
+// Filename: SolverFactory.cpp
+// Author:   Sameh Khamis
+//
+// Description: Explicit instantiations of RegionPushRelabel for the common
+//              grid layouts, and the factory that picks one at runtime
+/////////////////////////////////////////////////////////////////////////////
+#include "RegionPushRelabel.h"
+#include "SolverFactory.h"
+
+// Worker threads of every precompiled solver
+#ifndef SOLVER_THREAD_COUNT
+#define SOLVER_THREAD_COUNT 4
+#endif
+
+// Grids with more small blocks than this use the large blocks, which keep the per-block bookkeeping down
+static const size_t LARGE_GRID_BLOCKS = 1 << 20;
+
+typedef Array<
+	Arc<0, 0, Offsets<1, 0> >, Arc<0, 0, Offsets<-1, 0> >, Arc<0, 0, Offsets<0, 1> >, Arc<0, 0, Offsets<0, -1> >
+> FourConnected;
+
+typedef Array<
+	Arc<0, 0, Offsets<1, 0> >, Arc<0, 0, Offsets<-1, 0> >, Arc<0, 0, Offsets<0, 1> >, Arc<0, 0, Offsets<0, -1> >,
+	Arc<0, 0, Offsets<1, 1> >, Arc<0, 0, Offsets<-1, -1> >, Arc<0, 0, Offsets<1, -1> >, Arc<0, 0, Offsets<-1, 1> >
+> EightConnected;
+
+typedef Array<
+	Arc<0, 0, Offsets<1, 0, 0> >, Arc<0, 0, Offsets<-1, 0, 0> >, Arc<0, 0, Offsets<0, 1, 0> >,
+	Arc<0, 0, Offsets<0, -1, 0> >, Arc<0, 0, Offsets<0, 0, 1> >, Arc<0, 0, Offsets<0, 0, -1> >
+> SixConnected;
+
+// Faces and edges of the cube around a node
+typedef Array<
+	Arc<0, 0, Offsets<1, 0, 0> >, Arc<0, 0, Offsets<-1, 0, 0> >, Arc<0, 0, Offsets<0, 1, 0> >,
+	Arc<0, 0, Offsets<0, -1, 0> >, Arc<0, 0, Offsets<0, 0, 1> >, Arc<0, 0, Offsets<0, 0, -1> >,
+	Arc<0, 0, Offsets<1, 1, 0> >, Arc<0, 0, Offsets<-1, -1, 0> >, Arc<0, 0, Offsets<1, -1, 0> >,
+	Arc<0, 0, Offsets<-1, 1, 0> >, Arc<0, 0, Offsets<1, 0, 1> >, Arc<0, 0, Offsets<-1, 0, -1> >,
+	Arc<0, 0, Offsets<1, 0, -1> >, Arc<0, 0, Offsets<-1, 0, 1> >, Arc<0, 0, Offsets<0, 1, 1> >,
+	Arc<0, 0, Offsets<0, -1, -1> >, Arc<0, 0, Offsets<0, 1, -1> >, Arc<0, 0, Offsets<0, -1, 1> >
+> EighteenConnected;
+
+// Faces, edges and corners of the cube around a node
+typedef Array<
+	Arc<0, 0, Offsets<1, 0, 0> >, Arc<0, 0, Offsets<-1, 0, 0> >, Arc<0, 0, Offsets<0, 1, 0> >,
+	Arc<0, 0, Offsets<0, -1, 0> >, Arc<0, 0, Offsets<0, 0, 1> >, Arc<0, 0, Offsets<0, 0, -1> >,
+	Arc<0, 0, Offsets<1, 1, 0> >, Arc<0, 0, Offsets<-1, -1, 0> >, Arc<0, 0, Offsets<1, -1, 0> >,
+	Arc<0, 0, Offsets<-1, 1, 0> >, Arc<0, 0, Offsets<1, 0, 1> >, Arc<0, 0, Offsets<-1, 0, -1> >,
+	Arc<0, 0, Offsets<1, 0, -1> >, Arc<0, 0, Offsets<-1, 0, 1> >, Arc<0, 0, Offsets<0, 1, 1> >,
+	Arc<0, 0, Offsets<0, -1, -1> >, Arc<0, 0, Offsets<0, 1, -1> >, Arc<0, 0, Offsets<0, -1, 1> >,
+	Arc<0, 0, Offsets<1, 1, 1> >, Arc<0, 0, Offsets<-1, -1, -1> >, Arc<0, 0, Offsets<1, 1, -1> >,
+	Arc<0, 0, Offsets<-1, -1, 1> >, Arc<0, 0, Offsets<1, -1, 1> >, Arc<0, 0, Offsets<-1, 1, -1> >,
+	Arc<0, 0, Offsets<-1, 1, 1> >, Arc<0, 0, Offsets<1, -1, -1> >
+> TwentySixConnected;
+
+// The small blocks solve faster on single machines, see README
+typedef BlockDimensions<16, 16> SmallBlock2D;
+typedef BlockDimensions<32, 32> LargeBlock2D;
+typedef BlockDimensions<4, 4, 4> SmallBlock3D;
+typedef BlockDimensions<8, 8, 8> LargeBlock3D;
+
+#define INSTANTIATE_SOLVERS(CapType, FlowType, OffsetVector, SmallBlock, LargeBlock) \
+	template class RegionPushRelabel<CapType, FlowType, Layout<OffsetVector, SmallBlock>, ThreadCount<SOLVER_THREAD_COUNT> >; \
+	template class RegionPushRelabel<CapType, FlowType, Layout<OffsetVector, LargeBlock>, ThreadCount<SOLVER_THREAD_COUNT> >;
+
+#define INSTANTIATE_LAYOUTS(CapType, FlowType) \
+	INSTANTIATE_SOLVERS(CapType, FlowType, FourConnected, SmallBlock2D, LargeBlock2D) \
+	INSTANTIATE_SOLVERS(CapType, FlowType, EightConnected, SmallBlock2D, LargeBlock2D) \
+	INSTANTIATE_SOLVERS(CapType, FlowType, SixConnected, SmallBlock3D, LargeBlock3D) \
+	INSTANTIATE_SOLVERS(CapType, FlowType, EighteenConnected, SmallBlock3D, LargeBlock3D) \
+	INSTANTIATE_SOLVERS(CapType, FlowType, TwentySixConnected, SmallBlock3D, LargeBlock3D)
+
+INSTANTIATE_LAYOUTS(int, long)
+INSTANTIATE_LAYOUTS(float, double)
+
+template <typename CapType, typename FlowType, typename OffsetVector, typename SmallBlock, typename LargeBlock>
+static MaxflowSolver<size_t, CapType, FlowType>* create_grid_solver(long dimensions[])
+{
+	// Count the small blocks the way Layout pads the dimensions, without building its tables
+	size_t block_count = 1;
+	ptrdiff_t block_dimensions[Layout<OffsetVector, SmallBlock>::DIM_COUNT - 1];
+	mpl::for_each<SmallBlock>(CollectIntegers(block_dimensions));
+	for (size_t i = 0; i < Layout<OffsetVector, SmallBlock>::DIM_COUNT - 1; i++)
+		block_count *= (dimensions[i] + block_dimensions[i] - 1) / block_dimensions[i];
+
+	if (block_count <= LARGE_GRID_BLOCKS)
+		return new RegionPushRelabel<CapType, FlowType, Layout<OffsetVector, SmallBlock>, ThreadCount<SOLVER_THREAD_COUNT> >(dimensions);
+	return new RegionPushRelabel<CapType, FlowType, Layout<OffsetVector, LargeBlock>, ThreadCount<SOLVER_THREAD_COUNT> >(dimensions);
+}
+
+template <typename CapType, typename FlowType>
+MaxflowSolver<size_t, CapType, FlowType>* create_solver(long dimensions[], size_t dimension_count, int connectivity)
+{
+	if (dimension_count == 2)
+	{
+		switch (connectivity)
+		{
+		case 4: return create_grid_solver<CapType, FlowType, FourConnected, SmallBlock2D, LargeBlock2D>(dimensions);
+		case 8: return create_grid_solver<CapType, FlowType, EightConnected, SmallBlock2D, LargeBlock2D>(dimensions);
+		}
+	}
+	else if (dimension_count == 3)
+	{
+		switch (connectivity)
+		{
+		case 6: return create_grid_solver<CapType, FlowType, SixConnected, SmallBlock3D, LargeBlock3D>(dimensions);
+		case 18: return create_grid_solver<CapType, FlowType, EighteenConnected, SmallBlock3D, LargeBlock3D>(dimensions);
+		case 26: return create_grid_solver<CapType, FlowType, TwentySixConnected, SmallBlock3D, LargeBlock3D>(dimensions);
+		}
+	}
+	return NULL;
+}
+
+template MaxflowSolver<size_t, int, long>* create_solver<int, long>(long dimensions[], size_t dimension_count, int connectivity);
+template MaxflowSolver<size_t, float, double>* create_solver<float, double>(long dimensions[], size_t dimension_count, int connectivity);
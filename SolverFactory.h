@@ -0,0 +1,23 @@
+/////////////////////////////////////////////////////////////////////////////
+// Filename: SolverFactory.h
+// Author:   Sameh Khamis
+//
+// Description: Runtime selection of a precompiled RegionPushRelabel solver
+//              for the common grid layouts (make lib)
+/////////////////////////////////////////////////////////////////////////////
+#ifndef _SOLVER_FACTORY
+#define _SOLVER_FACTORY
+
+#include <cstddef>
+using namespace std;
+
+#include "MaxflowSolver.h"
+
+// Creates a solver for a 2D grid that is 4- or 8-connected, or a 3D grid that is 6-, 18- or 26-connected,
+// with int capacities and long flow, or float capacities and double flow. Node ids are numbered with the
+// first dimension varying fastest, as in Example.cpp. Returns NULL if no precompiled solver matches,
+// otherwise the caller deletes the solver
+template <typename CapType, typename FlowType>
+MaxflowSolver<size_t, CapType, FlowType>* create_solver(long dimensions[], size_t dimension_count, int connectivity);
+
+#endif
@@ -0,0 +1,122 @@
+/////////////////////////////////////////////////////////////////////////////
+// Filename: StreamingTest.cpp
+// Author:   Sameh Khamis
+//
+// Description: Checks the flow of a graph solved while it is being built
+//              against the same graph built first, build with "make test"
+/////////////////////////////////////////////////////////////////////////////
+#include <iostream>
+#include <cstdlib>
+#include <vector>
+using namespace std;
+
+#include "RegionPushRelabel.h"
+
+typedef Array<
+	Arc<0, 0, Offsets<1, 0, 0> >,
+	Arc<0, 0, Offsets<-1, 0, 0> >,
+	Arc<0, 0, Offsets<0, 1, 0> >,
+	Arc<0, 0, Offsets<0, -1, 0> >,
+	Arc<0, 0, Offsets<0, 0, 1> >,
+	Arc<0, 0, Offsets<0, 0, -1> >
+> SixConnected;
+
+typedef RegionPushRelabel<
+	int, long long,
+	Layout<
+		SixConnected,
+		BlockDimensions<4, 4, 4>
+	>,
+	ThreadCount<4>
+> RegularGraph;
+
+struct Edge
+{
+	int i, j, cap, rev_cap;
+};
+
+// Adds the nodes from first up to last and the edges leaving them, edges are sorted by their first node
+void add_nodes(RegularGraph* g, int first, int last, vector<int>& src_caps, vector<int>& snk_caps, vector<Edge>& edges, size_t& e)
+{
+	for (int i = first; i < last; i++)
+		if (src_caps[i] != 0 || snk_caps[i] != 0)
+			g->add_terminal_weights(i, src_caps[i], snk_caps[i]);
+	for (; e < edges.size() && edges[e].i < last; e++)
+		g->add_edge(edges[e].i, edges[e].j, edges[e].cap, edges[e].rev_cap);
+}
+
+int main()
+{
+	// Workers start on the loaded layers while the next ones are still being added
+	const int layers_per_mark = 2;
+	int failed = 0;
+
+	for (int seed = 0; seed < 4; seed++)
+	{
+		int width = 18 + seed, height = 14 + seed * 2, depth = 17 + seed * 5;
+		int layer = width * height, n = layer * depth;
+		long d[] = {width, height, depth};
+		srand(seed);
+
+		// A third of the nodes have no terminal edges
+		vector<int> src_caps(n, 0), snk_caps(n, 0);
+		vector<Edge> edges;
+		for (int z = 0; z < depth; z++)
+			for (int y = 0; y < height; y++)
+				for (int x = 0; x < width; x++)
+				{
+					int i = z * layer + y * width + x;
+					if (rand() % 3)
+					{
+						src_caps[i] = rand() % 20;
+						snk_caps[i] = rand() % 20;
+					}
+
+					if (x + 1 < width)
+					{
+						Edge e = { i, i + 1, rand() % 10, rand() % 10 };
+						edges.push_back(e);
+					}
+					if (y + 1 < height)
+					{
+						Edge e = { i, i + width, rand() % 10, rand() % 10 };
+						edges.push_back(e);
+					}
+					if (z + 1 < depth)
+					{
+						Edge e = { i, i + layer, rand() % 10, rand() % 10 };
+						edges.push_back(e);
+					}
+				}
+
+		// Streamed, with the solve running while the layers are added
+		RegularGraph *g = new RegularGraph(d);
+		size_t e = 0;
+		g->start_maxflow();
+		for (int z = 0; z < depth; z += layers_per_mark)
+		{
+			g->mark_loaded(z * layer);
+			add_nodes(g, z * layer, min(z + layers_per_mark, depth) * layer, src_caps, snk_caps, edges, e);
+		}
+		g->compute_maxflow();
+		long long streamed = g->get_flow();
+		delete g;
+
+		// Built first, then solved
+		g = new RegularGraph(d);
+		e = 0;
+		add_nodes(g, 0, n, src_caps, snk_caps, edges, e);
+		g->compute_maxflow();
+		long long flow = g->get_flow();
+		delete g;
+
+		if (streamed != flow)
+		{
+			cout << "Seed " << seed << ": flow = " << streamed << ", expected " << flow << endl;
+			failed++;
+		}
+	}
+
+	cout << (failed ? "FAILED" : "PASSED") << endl;
+	return failed;
+}
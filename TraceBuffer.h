@@ -0,0 +1,106 @@
+/////////////////////////////////////////////////////////////////////////////
+// Filename: TraceBuffer.h
+// Author:   Sameh Khamis
+//
+// Description: Fixed-size ring buffer of timestamped events, written out in
+//              the Chrome trace-event format (chrome://tracing)
+/////////////////////////////////////////////////////////////////////////////
+#ifndef _TRACE_BUFFER
+#define _TRACE_BUFFER
+
+#include <vector>
+#include <string>
+#include <ostream>
+using namespace std;
+
+#include <boost/cstdint.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/date_time/posix_time/conversion.hpp>
+
+class TraceBuffer
+{
+public:
+	typedef boost::int64_t int64;
+
+private:
+	// Spans are stored once they end, so that a wrapped buffer never holds half a span
+	struct Event
+	{
+		int64 start;
+		int64 duration; // -1 for instant events
+		const char* name;
+		const char* arg_name; // NULL for no argument
+		size_t arg;
+	};
+
+	vector<Event> events;
+	size_t next;
+	bool wrapped;
+
+	void record(const char* name, int64 start, int64 duration, const char* arg_name, size_t arg)
+	{
+		Event& event = events[next];
+		event.start = start;
+		event.duration = duration;
+		event.name = name;
+		event.arg_name = arg_name;
+		event.arg = arg;
+
+		// Overwrite the oldest events once full
+		if (++next == events.size())
+		{
+			next = 0;
+			wrapped = true;
+		}
+	}
+
+public:
+	TraceBuffer(size_t capacity = 65536) : events(capacity), next(0), wrapped(false)
+	{
+	}
+
+	// Microseconds since the epoch, names and argument names must be string literals
+	static int64 now()
+	{
+		using namespace boost::posix_time;
+		return (microsec_clock::universal_time() - from_time_t(0)).total_microseconds();
+	}
+
+	void instant(const char* name, const char* arg_name = NULL, size_t arg = 0)
+	{
+		record(name, now(), -1, arg_name, arg);
+	}
+
+	void span(const char* name, int64 start, const char* arg_name = NULL, size_t arg = 0)
+	{
+		record(name, start, now() - start, arg_name, arg);
+	}
+
+	// Writes the thread name and all the events, oldest first, each preceded by a comma unless first is set
+	void write(ostream& out, int pid, int tid, const string& thread_name, bool& first) const
+	{
+		out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << tid
+			<< ",\"args\":{\"name\":\"" << thread_name << "\"}}";
+		first = false;
+
+		size_t count = wrapped ? events.size() : next;
+		size_t i = wrapped ? next : 0;
+		for (size_t k = 0; k < count; k++, i++)
+		{
+			if (i == events.size())
+				i = 0;
+
+			const Event& event = events[i];
+			out << ",\n{\"name\":\"" << event.name << "\",\"pid\":" << pid << ",\"tid\":" << tid << ",\"ts\":" << event.start;
+			if (event.duration < 0)
+				out << ",\"ph\":\"i\",\"s\":\"t\"";
+			else
+				out << ",\"ph\":\"X\",\"dur\":" << event.duration;
+			if (event.arg_name != NULL)
+				out << ",\"args\":{\"" << event.arg_name << "\":" << event.arg << "}";
+			out << "}";
+		}
+	}
+};
+
+#endif